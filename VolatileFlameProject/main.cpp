@@ -1,10 +1,14 @@
 #define _USE_MATH_DEFINES
 #include "stb_image.h"
+#include "frame_arena.h"
+#include "render_state.h"
+#include "texture_container.h"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <vector>
 #include <math.h>
+#include <stdio.h>
 #include <shader.h>
 #include <camera.h>
 #include <filesystem>
@@ -69,7 +73,8 @@ void bindTextures();
 void setAnimationValues(int freq, int amp);
 void setMaterialUniforms();
 void setLightUniforms();
-unsigned int loadTexture(const char* filepath);
+std::vector<unsigned int> loadTextures(const std::vector<std::string>& filepaths);
+unsigned int uploadTexture(const TextureContainer& container);
 void FPSUpdate();
 std::vector<float> buildUnitPositiveX(int subdivision);
 
@@ -149,25 +154,27 @@ int main()
 	glDepthFunc(GL_LESS); // draws fragments that are closer to the screen in NDC
 
 	// load textures
-	rockTexture = loadTexture("Textures/rockTexture.jpg");
-	lavaTexture = loadTexture("Textures/lavaTexture.jpg");
-	rockHeightmap = loadTexture("Textures/rockHeightmap.jpg");
-	waveHeightmap = loadTexture("Textures/waveHeightmap.jpg");
-	noiseHeightmap = loadTexture("Textures/noiseHeightmap.jpg");
+	std::vector<unsigned int> textures = loadTextures({ "Textures/rockTexture.jpg", "Textures/lavaTexture.jpg",
+		"Textures/rockHeightmap.jpg", "Textures/waveHeightmap.jpg", "Textures/noiseHeightmap.jpg" });
+	rockTexture = textures[0];
+	lavaTexture = textures[1];
+	rockHeightmap = textures[2];
+	waveHeightmap = textures[3];
+	noiseHeightmap = textures[4];
 
 	// assign textures to shaders
 	shader = pulsingVolatilePhongShader;
 	shader->use();
-	glUniform1i(glGetUniformLocation(shader->ID, "rockTexture"), rockTexture);
-	glUniform1i(glGetUniformLocation(shader->ID, "lavaTexture"), lavaTexture);
-	glUniform1i(glGetUniformLocation(shader->ID, "rockHeightmap"), rockHeightmap);
+	shader->setInt("rockTexture", rockTexture);
+	shader->setInt("lavaTexture", lavaTexture);
+	shader->setInt("rockHeightmap", rockHeightmap);
 	
 	shader = wobbleVolatilePhongShader;
 	shader->use();
-	glUniform1i(glGetUniformLocation(shader->ID, "rockTexture"), rockTexture);
-	glUniform1i(glGetUniformLocation(shader->ID, "lavaTexture"), lavaTexture);
-	glUniform1i(glGetUniformLocation(shader->ID, "waveHeightmap"), waveHeightmap);
-	glUniform1i(glGetUniformLocation(shader->ID, "noiseHeightmap"), noiseHeightmap);
+	shader->setInt("rockTexture", rockTexture);
+	shader->setInt("lavaTexture", lavaTexture);
+	shader->setInt("waveHeightmap", waveHeightmap);
+	shader->setInt("noiseHeightmap", noiseHeightmap);
 
 	// Print frequency and amplitude values
 	std::cout << "Frequency: " << frequency << " Amplitude: " << amplitude << "\n";
@@ -175,6 +182,9 @@ int main()
 	// Create a sphere
 	sceneObjects.push_back(instantiateSphere());
 
+	// all texture binds of the render loop go through the render state, so it can skip the ones that change nothing
+	RenderState::instance().setCaching(true);
+
 	// render loop
 	while (!glfwWindowShouldClose(window)) {
 		FPSUpdate();
@@ -234,7 +244,7 @@ int main()
 			// draw geometry
 			glDrawElements(GL_TRIANGLES, sceneObjects[i].indecesCount, GL_UNSIGNED_INT, 0);
 			glBindVertexArray(0);
-			glActiveTexture(GL_TEXTURE0);
+			RenderState::instance().activeTexture(0);
 		}
 
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -245,12 +255,15 @@ int main()
 		glGetShaderiv(shader->ID, GL_INFO_LOG_LENGTH, &maxLength);
 
 		// The maxLength includes the NULL character
-		std::vector<GLchar> errorLog(maxLength);
+		FrameVector<GLchar> errorLog(maxLength);
 		glGetShaderInfoLog(shader->ID, maxLength, &maxLength, &errorLog[0]);
 
 		// Provide the infolog in whatever manner you deem best.
 		// The errorLog vector contains the log message as a C string.
 		std::cerr << &errorLog[0] << std::endl;
+
+		// everything allocated in the frame arena during this frame is free again
+		FrameArena::instance().reset();
 	}
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
@@ -284,17 +297,14 @@ void setAnimationValues(int freq, int amp)
 	shader->setFloat("amplitude", amp);
 }
 
+// every texture sits on the unit with its own id, after the first object the render state skips all of these
 void bindTextures() {
-	glActiveTexture(GL_TEXTURE0 + lavaTexture);
-	glBindTexture(GL_TEXTURE_2D, lavaTexture);
-	glActiveTexture(GL_TEXTURE0 + rockTexture);
-	glBindTexture(GL_TEXTURE_2D, rockTexture);
-	glActiveTexture(GL_TEXTURE0 + waveHeightmap);
-	glBindTexture(GL_TEXTURE_2D, waveHeightmap);
-	glActiveTexture(GL_TEXTURE0 + noiseHeightmap);
-	glBindTexture(GL_TEXTURE_2D, noiseHeightmap);
-	glActiveTexture(GL_TEXTURE0 + rockHeightmap);
-	glBindTexture(GL_TEXTURE_2D, rockHeightmap);
+	RenderState& renderState = RenderState::instance();
+	renderState.bindTexture(lavaTexture, GL_TEXTURE_2D, lavaTexture);
+	renderState.bindTexture(rockTexture, GL_TEXTURE_2D, rockTexture);
+	renderState.bindTexture(waveHeightmap, GL_TEXTURE_2D, waveHeightmap);
+	renderState.bindTexture(noiseHeightmap, GL_TEXTURE_2D, noiseHeightmap);
+	renderState.bindTexture(rockHeightmap, GL_TEXTURE_2D, rockHeightmap);
 }
 
 //inspiration: http://www.songho.ca/opengl/gl_sphere.html
@@ -451,35 +461,49 @@ SceneObject instantiateSphere() {
 	return sceneObject;
 }
 
-unsigned int loadTexture(const char* filepath) {
-	std::cout << "Loading texture from file: ";
-	std::cout << filepath;
-	std::cout << " ... ";
+std::vector<unsigned int> loadTextures(const std::vector<std::string>& filepaths) {
+	// textures are converted once to containers holding all their mip levels, later runs only map them.
+	// the files are converted (or mapped) in parallel, only the upload has to happen on this thread
+	std::vector<TextureContainer> containers(filepaths.size());
+	ImageDecoder::parallelFor(filepaths.size(), [&containers, &filepaths](size_t i) {
+		std::string containerFile = TextureContainer::containerPath(filepaths[i], false);
+		if(TextureContainer::isUpToDate(containerFile, filepaths[i]) && containers[i].load(containerFile))
+			return;
+
+		std::vector<DecodedImage> images(1, ImageDecoder::decodeFile(filepaths[i], 3));
+		if(images[0].data) {
+			containers[i] = TextureContainer::fromImages(images, false, TextureContainer::None);
+			containers[i].write(containerFile);
+		}
+		images[0].free();
+	});
+
+	std::vector<unsigned int> textures;
+	for(unsigned int i = 0; i < containers.size(); i++) {
+		std::cout << "Loading texture from file: ";
+		std::cout << filepaths[i];
+		std::cout << " ... ";
+		textures.push_back(uploadTexture(containers[i]));
+	}
+	return textures;
+}
+
+unsigned int uploadTexture(const TextureContainer& container) {
 	// Generate texture. Code inspired from https://learnopengl.com/Getting-started/Textures
-	unsigned int texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	// set the texture wrapping/filtering options (on the currently bound texture object)
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// load and generate the texture
-	int width, height, nrChannels;
-	unsigned char* data = stbi_load(filepath, &width, &height, &nrChannels, 0);
-	if (data)
+	unsigned int texture = container.upload();
+	if (texture != 0)
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		// set the texture wrapping/filtering options (on the currently bound texture object)
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		std::cout << "Complete\n";
 	}
 	else
 	{
 		std::cout << "Failed to load texture" << std::endl;
 	}
-	stbi_image_free(data);
 	return texture;
 }
 
@@ -597,9 +621,22 @@ void FPSUpdate()
 	deltaTime = currentFrame - lastFrame;
 	lastFrame = currentFrame;
 
-	// Creates new title
+	// Creates new title, in the frame arena so it doesn't go to the heap every frame. the numbers are formatted on the
+	// stack, std::to_string would build a std::string for each of them
 	int FPS = (1.0 / deltaTime);
-	std::string newTitle = windowName + std::to_string(FPS) + " FPS / " + std::to_string(deltaTime) + " ms";
+	RenderState& renderState = RenderState::instance();
+	FrameArena& arena = FrameArena::instance();
+	char numbers[160];
+	snprintf(numbers, sizeof(numbers), "%d FPS / %f ms / %u state calls, %u skipped / %u allocations, %u on the heap",
+		FPS, deltaTime,
+		// GL state calls of the last frame, sent to the driver and skipped as redundant
+		renderState.issuedCalls(), renderState.skippedCalls(),
+		// allocations of the last frame in the arena, and the ones the arena itself made on the heap
+		arena.allocationsLastFrame(), arena.heapAllocationsLastFrame());
+	renderState.resetCounters();
+
+	FrameString newTitle(windowName);
+	newTitle += numbers;
 	glfwSetWindowTitle(window, newTitle.c_str());
 }
 
@@ -8,6 +8,8 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 
 /// Shader class from https://learnopengl.com
@@ -94,6 +96,8 @@ public:
             glAttachShader(ID, geometry);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        // resolve the location of every active uniform once, so the setters don't query the driver
+        loadActiveUniforms();
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -109,64 +113,166 @@ public:
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
+    // returns the location of an active uniform, or -1 if the program doesn't use it.
+    // store the result and use the location overloads below in hot loops to skip the name lookup
+    GLint getUniformLocation(const std::string &name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator it = uniformLocations.find(name);
+        return it != uniformLocations.end() ? it->second : -1;
+    }
+    // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        setBool(getUniformLocation(name), value);
+    }
+    void setBool(GLint location, bool value) const
+    {
+        glUniform1i(location, (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        setInt(getUniformLocation(name), value);
+    }
+    void setInt(GLint location, int value) const
+    {
+        glUniform1i(location, value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        setFloat(getUniformLocation(name), value);
+    }
+    void setFloat(GLint location, float value) const
+    {
+        glUniform1f(location, value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec2(getUniformLocation(name), value);
     }
     void setVec2(const std::string &name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        setVec2(getUniformLocation(name), x, y);
+    }
+    void setVec2(GLint location, const glm::vec2 &value) const
+    {
+        glUniform2fv(location, 1, &value[0]);
+    }
+    void setVec2(GLint location, float x, float y) const
+    {
+        glUniform2f(location, x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec3(getUniformLocation(name), value);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        setVec3(getUniformLocation(name), x, y, z);
+    }
+    void setVec3(GLint location, const glm::vec3 &value) const
+    {
+        glUniform3fv(location, 1, &value[0]);
+    }
+    void setVec3(GLint location, float x, float y, float z) const
+    {
+        glUniform3f(location, x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec4(getUniformLocation(name), value);
+    }
+    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    {
+        setVec4(getUniformLocation(name), x, y, z, w);
+    }
+    void setVec4(GLint location, const glm::vec4 &value) const
+    {
+        glUniform4fv(location, 1, &value[0]);
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w)
+    void setVec4(GLint location, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(location, x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat2(getUniformLocation(name), mat);
+    }
+    void setMat2(GLint location, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat3(getUniformLocation(name), mat);
+    }
+    void setMat3(GLint location, const glm::mat3 &mat) const
+    {
+        glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(getUniformLocation(name), mat);
+    }
+    void setMat4(GLint location, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    // uniform name -> location, filled after linking
+    std::unordered_map<std::string, GLint> uniformLocations;
+
+    // queries all the active uniforms of the program and stores their locations.
+    // arrays are registered both by their base name and by each of their elements
+    // ------------------------------------------------------------------------
+    void loadActiveUniforms()
+    {
+        uniformLocations.clear();
+
+        GLint maxNameLength = 0, uniformCount = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &uniformCount);
+        if(maxNameLength <= 0)
+            return;
+
+        std::vector<GLchar> nameBuffer(maxNameLength);
+        for(GLint i = 0; i < uniformCount; ++i)
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, maxNameLength, nullptr, &size, &type, &nameBuffer[0]);
+
+            std::string name(&nameBuffer[0]);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            // uniforms inside uniform blocks don't have a location
+            if(location == -1)
+                continue;
+
+            uniformLocations[name] = location;
+
+            // array uniforms are reported as "name[0]", resolve the remaining elements as well
+            std::string::size_type bracket = name.rfind("[0]");
+            if(bracket != std::string::npos && bracket + 3 == name.size())
+            {
+                std::string baseName = name.substr(0, bracket);
+                uniformLocations[baseName] = location;
+                for(GLint element = 1; element < size; ++element)
+                {
+                    std::string elementName = baseName + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+                }
+            }
+        }
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,294 @@
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <render_state.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// spreads buffer and texture uploads over several frames, so loading content doesn't stall the frame that creates it.
+// every frame update() copies up to the frame budget into a staging buffer and from there into the destination objects.
+// the staging buffer is a ring: persistently mapped on GL 4.4, mapped unsynchronized per write below that, and fences
+// tell when the GPU is done reading a frame's part of it. with a budget of 0 (the default) uploads happen right away
+class UploadQueue
+{
+public:
+    static UploadQueue& instance()
+    {
+        static UploadQueue queue;
+        return queue;
+    }
+
+    // bytes uploaded per frame. the staging buffer holds three frames, so the GPU can still read the previous ones
+    void setFrameBudget(size_t bytes)
+    {
+        frameBudget = bytes;
+    }
+
+    bool streaming() const { return frameBudget > 0; }
+
+    // copies size bytes to the buffer, which must already have its storage, starting at offset.
+    // the data is copied, so the caller can free it. done runs on the GL thread once the bytes have landed
+    void uploadBuffer(GLuint buffer, size_t offset, const void *data, size_t size, std::function<void()> done = nullptr)
+    {
+        if (!streaming())
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)offset, (GLsizeiptr)size, data);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            if (done)
+                done();
+            return;
+        }
+        Request request;
+        request.texture = false;
+        request.object = buffer;
+        request.bufferOffset = offset;
+        request.offset = 0;
+        request.rowCount = 0;
+        request.data.assign((const unsigned char*)data, (const unsigned char*)data + size);
+        request.done = done;
+        requests.push_back(request);
+    }
+
+    // copies a level of a texture whose storage is already allocated. uncompressed rows are padded to 4 bytes, and when
+    // type is 0 the data is compressed in 4x4 blocks of the given internal format. target is the texture's binding target,
+    // faceTarget the face of a cube map or the same as target
+    void uploadTexture(GLuint texture, GLenum target, GLenum faceTarget, GLint level, int width, int height, GLenum format, GLenum type,
+                       const void *data, size_t size, std::function<void()> done = nullptr)
+    {
+        Request request;
+        request.texture = true;
+        request.object = texture;
+        request.target = target;
+        request.faceTarget = faceTarget;
+        request.level = level;
+        request.width = width;
+        request.height = height;
+        request.format = format;
+        request.type = type;
+        request.bufferOffset = 0;
+        request.offset = 0;
+        // compressed rows are rows of blocks
+        request.rowCount = type == 0 ? (height + 3) / 4 : height;
+        if (!streaming())
+        {
+            RenderState::instance().bindTexture(0, target, texture);
+            copyRows(request, (const unsigned char*)data, 0, request.rowCount, size);
+            if (done)
+                done();
+            return;
+        }
+        request.data.assign((const unsigned char*)data, (const unsigned char*)data + size);
+        request.done = done;
+        requests.push_back(request);
+    }
+
+    // uploads the next part of the queue. call once per frame, on the thread that owns the context. textures are bound
+    // through the render state, so its cache stays valid across frames
+    void update()
+    {
+        bytesLastFrame = 0;
+        retireFrames();
+        if (requests.empty() || !streaming())
+            return;
+        if (stagingBuffer == 0)
+            createStagingBuffer();
+
+        size_t frameStart = used;
+        size_t budget = frameBudget;
+        glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+        while (!requests.empty() && budget > 0)
+        {
+            Request &request = requests.front();
+
+            // buffers go in pieces of any size, textures in whole rows, at least one even if it goes over the budget
+            size_t bytes = std::min(request.data.size() - request.offset, budget);
+            size_t rowSize = 0, rows = 0;
+            if (request.texture)
+            {
+                rowSize = request.data.size() / request.rowCount;
+                rows = std::min(request.rowCount - request.offset / rowSize, std::max<size_t>(budget / rowSize, 1));
+                bytes = rows * rowSize;
+            }
+
+            // a piece that would never fit in the ring is copied directly from memory
+            size_t stagingOffset;
+            bool staged = bytes <= stagingCapacity;
+            if (staged && !allocate(bytes, stagingOffset))
+                break;
+            const unsigned char *source = &request.data[request.offset];
+            if (staged)
+            {
+                writeStaging(stagingOffset, source, bytes);
+                source = (const unsigned char*)stagingOffset;
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staged ? stagingBuffer : 0);
+
+            if (request.texture)
+            {
+                RenderState::instance().bindTexture(0, request.target, request.object);
+                copyRows(request, source, request.offset / rowSize, rows, bytes);
+            }
+            else
+            {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, request.object);
+                GLintptr destination = (GLintptr)(request.bufferOffset + request.offset);
+                if (staged)
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)stagingOffset, destination, (GLsizeiptr)bytes);
+                else
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, destination, (GLsizeiptr)bytes, source);
+            }
+
+            request.offset += bytes;
+            budget -= std::min(budget, bytes);
+            bytesLastFrame += bytes;
+            if (request.offset == request.data.size())
+            {
+                std::function<void()> done = request.done;
+                requests.pop_front();
+                if (done)
+                    done();
+            }
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // the staging bytes of this frame are free again once the GPU passes this fence
+        if (used > frameStart)
+        {
+            Frame frame;
+            frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            frame.bytes = used - frameStart;
+            frames.push_back(frame);
+        }
+    }
+
+    // bytes still waiting in the queue
+    size_t pendingBytes() const
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < requests.size(); i++)
+            bytes += requests[i].data.size() - requests[i].offset;
+        return bytes;
+    }
+
+    size_t uploadedLastFrame() const { return bytesLastFrame; }
+
+    // the queue is a process-wide singleton
+    UploadQueue(const UploadQueue&) = delete;
+    UploadQueue& operator=(const UploadQueue&) = delete;
+
+private:
+    UploadQueue() : frameBudget(0), bytesLastFrame(0), stagingBuffer(0), stagingCapacity(0), mapped(nullptr), head(0), used(0) {}
+
+    struct Request
+    {
+        bool texture;
+        GLuint object;
+        GLenum target, faceTarget, format, type;
+        GLint level;
+        int width, height;
+        size_t rowCount;
+        size_t offset;       // bytes already uploaded
+        size_t bufferOffset; // where the data goes in a buffer
+        std::vector<unsigned char> data;
+        std::function<void()> done;
+    };
+
+    struct Frame
+    {
+        GLsync fence;
+        size_t bytes;
+    };
+
+    size_t frameBudget, bytesLastFrame;
+    std::deque<Request> requests;
+    std::deque<Frame> frames;
+    GLuint stagingBuffer;
+    size_t stagingCapacity;
+    unsigned char *mapped; // the persistent mapping, nullptr below GL 4.4
+    size_t head, used;     // next byte to write, and bytes the GPU may still read
+
+    void createStagingBuffer()
+    {
+        stagingCapacity = 3 * frameBudget;
+        glGenBuffers(1, &stagingBuffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+        if (GLAD_GL_VERSION_4_4)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_READ_BUFFER, (GLsizeiptr)stagingCapacity, NULL, flags);
+            mapped = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)stagingCapacity, flags);
+        }
+        else
+            glBufferData(GL_COPY_READ_BUFFER, (GLsizeiptr)stagingCapacity, NULL, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    // reserves contiguous staging bytes, wrapping around the end of the ring. fails if the GPU still reads them
+    bool allocate(size_t bytes, size_t &offset)
+    {
+        // offsets stay 4 byte aligned, as the pixel unpack alignment expects
+        size_t aligned = (bytes + 3) & ~(size_t)3;
+        size_t wasted = head + aligned > stagingCapacity ? stagingCapacity - head : 0;
+        if (used + wasted + aligned > stagingCapacity)
+            return false;
+        if (wasted > 0)
+            head = 0;
+        offset = head;
+        head = (head + aligned) % stagingCapacity;
+        used += wasted + aligned;
+        return true;
+    }
+
+    void writeStaging(size_t offset, const unsigned char *data, size_t bytes)
+    {
+        if (mapped)
+        {
+            std::memcpy(mapped + offset, data, bytes);
+            return;
+        }
+        // the fences already guarantee that the GPU is done with this range
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        void *destination = glMapBufferRange(GL_COPY_READ_BUFFER, (GLintptr)offset, (GLsizeiptr)bytes, flags);
+        if (destination)
+            std::memcpy(destination, data, bytes);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+    }
+
+    void retireFrames()
+    {
+        while (!frames.empty())
+        {
+            GLenum status = glClientWaitSync(frames.front().fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(frames.front().fence);
+            used -= frames.front().bytes;
+            frames.pop_front();
+        }
+    }
+
+    // uploads rows [firstRow, firstRow + rowCount) of a texture request from pixels, a pointer or an offset in the unpack buffer
+    static void copyRows(const Request &request, const unsigned char *pixels, size_t firstRow, size_t rowCount, size_t bytes)
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if (request.type == 0)
+        {
+            // block rows cover 4 pixel rows, the last one may be cut by the edge of the texture
+            GLint y = (GLint)firstRow * 4;
+            GLsizei height = std::min((GLsizei)rowCount * 4, request.height - y);
+            glCompressedTexSubImage2D(request.faceTarget, request.level, 0, y, request.width, height, request.format, (GLsizei)bytes, pixels);
+        }
+        else
+            glTexSubImage2D(request.faceTarget, request.level, 0, (GLint)firstRow, request.width, (GLsizei)rowCount, request.format, request.type, pixels);
+    }
+};
+#endif
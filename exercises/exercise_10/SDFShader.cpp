@@ -8,6 +8,7 @@
 #include <string>
 
 #include "RayMarcher.h"
+#include "program_cache.h"
 
 SDFShader::SDFShader(const char* vertexPath, const char* fragmentPath)
     : m_Program(0)
@@ -46,6 +47,17 @@ void SDFShader::Reload() const
         if (!RayMarcher::HasSourceChanged() && m_VertexHash == prevVertexHash && m_FragmentHash == prevFragmentHash)
             return;
 
+        // a program binary stored by a previous run for the same sources skips compiling them
+        ProgramCache& programCache = ProgramCache::instance();
+        std::string programKey = programCache.key({ vertexShaderCode, RayMarcher::GetSDFLibrarySource(), fragmentShaderCode, RayMarcher::GetRayMarcherSource() });
+        GLuint cachedProgram = programCache.load(programKey);
+        if (cachedProgram)
+        {
+            glDeleteProgram(m_Program);
+            m_Program = cachedProgram;
+            return;
+        }
+
         GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
         const char* vertexSources[] = { vertexShaderCode.c_str() };
         glShaderSource(vertexShader, 1, vertexSources, nullptr);
@@ -63,12 +75,17 @@ void SDFShader::Reload() const
             glAttachShader(program, vertexShader);
             glAttachShader(program, fragmentShader);
 
+            programCache.prepare(program);
             glLinkProgram(program);
             if (!CheckShaderErrors(program))
             {
                 glDeleteProgram(m_Program);
                 program = 0;
             }
+            else
+            {
+                programCache.store(program, programKey);
+            }
         }
 
         if (program)
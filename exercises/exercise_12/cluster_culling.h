@@ -0,0 +1,225 @@
+#ifndef CLUSTER_CULLING_H
+#define CLUSTER_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <camera.h>
+#include <model.h>
+#include <shader.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// culls the clusters of every instance of a model on the GPU, against the frustum and with the normal cones, and draws
+// what is left with one glMultiDrawElementsIndirect per mesh.
+// there is one indirect command per cluster. the compute shader counts the visible instances of the cluster in the
+// command's instanceCount and writes their indices to the cluster's slice of the visible instance buffer, which starts at
+// the command's baseInstance. that buffer is an instanced vertex attribute, so baseInstance offsets it for every command,
+// and the vertex shader reads the instance index from it instead of using gl_InstanceID
+class ClusterCuller
+{
+public:
+    // instanceIndexLocation is the attribute the vertex shader reads the instance index from
+    ClusterCuller(Model &model, unsigned int maxInstances, GLuint instanceIndexLocation = 5) : model(model), maxInstances(maxInstances)
+    {
+        // the clusters of all meshes are culled in one dispatch, each mesh draws its own range of commands
+        vector<GpuCluster> clusters;
+        vector<DrawCommand> commands;
+        instanceRadius = 0.0f;
+        for (unsigned int m = 0; m < model.meshes.size(); m++)
+        {
+            const Mesh &mesh = model.meshes[m];
+            meshFirstCommand.push_back((unsigned int)commands.size());
+            for (unsigned int c = 0; c < mesh.clusters.size(); c++)
+            {
+                const MeshCluster &cluster = mesh.clusters[c];
+                GpuCluster gpuCluster;
+                gpuCluster.boundingSphere = cluster.boundingSphere;
+                gpuCluster.normalCone = cluster.normalCone;
+                clusters.push_back(gpuCluster);
+
+                DrawCommand command;
+                command.count = cluster.indexCount;
+                command.instanceCount = 0;
+                command.firstIndex = cluster.firstIndex;
+                command.baseVertex = 0;
+                command.baseInstance = (GLuint)commands.size() * maxInstances;
+                commands.push_back(command);
+
+                // instances are culled with a sphere around their origin that holds every cluster
+                instanceRadius = std::max(instanceRadius, glm::length(glm::vec3(cluster.boundingSphere)) + cluster.boundingSphere.w);
+            }
+        }
+        meshFirstCommand.push_back((unsigned int)commands.size());
+        clusterCount = (unsigned int)commands.size();
+
+        glGenBuffers(1, &clusterBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, clusters.size() * sizeof(GpuCluster), clusters.data(), GL_STATIC_DRAW);
+
+        // the commands are reset from a copy with zero instances before every culling pass
+        glGenBuffers(1, &commandTemplateBuffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, commandTemplateBuffer);
+        glBufferData(GL_COPY_READ_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &commandBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_DYNAMIC_DRAW);
+
+        glGenBuffers(1, &visibleInstanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, visibleInstanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)clusterCount * maxInstances * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+
+        // add the instance index attribute to the meshes' vertex arrays
+        for (unsigned int m = 0; m < model.meshes.size(); m++)
+        {
+            glBindVertexArray(model.meshes[m].VAO);
+            glEnableVertexAttribArray(instanceIndexLocation);
+            glVertexAttribIPointer(instanceIndexLocation, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+            glVertexAttribDivisor(instanceIndexLocation, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        cullingProgram = createComputeProgram("shaders/cluster_culling.glsl");
+    }
+
+    ~ClusterCuller()
+    {
+        glDeleteBuffers(1, &clusterBuffer);
+        glDeleteBuffers(1, &commandTemplateBuffer);
+        glDeleteBuffers(1, &commandBuffer);
+        glDeleteBuffers(1, &visibleInstanceBuffer);
+        glDeleteProgram(cullingProgram);
+    }
+
+    // cullers own GL objects, so they can't be copied
+    ClusterCuller(const ClusterCuller&) = delete;
+    ClusterCuller& operator=(const ClusterCuller&) = delete;
+
+    // culls the clusters of the first instanceCount instances in instanceBuffer, an array of { mat4 model; vec4 color; }
+    void Cull(const Camera &camera, GLuint instanceBuffer, unsigned int instanceCount)
+    {
+        instanceCount = std::min(instanceCount, maxInstances);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, commandTemplateBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, clusterCount * sizeof(DrawCommand));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        glUseProgram(cullingProgram);
+
+        glm::vec3 planes[6 * 2];
+        for (int plane = (int)Camera_Planes::FIRST_PLANE; plane < (int)Camera_Planes::PLANE_COUNT; ++plane)
+            camera.GetFrustumPlane((Camera_Planes)plane, planes[plane * 2], planes[plane * 2 + 1]);
+        glUniform3fv(glGetUniformLocation(cullingProgram, "frustumPlanes"), 6 * 2, (const float*)planes);
+        glUniform3fv(glGetUniformLocation(cullingProgram, "cameraPosition"), 1, &camera.Position[0]);
+        glUniform1f(glGetUniformLocation(cullingProgram, "instanceRadius"), instanceRadius);
+        glUniform1ui(glGetUniformLocation(cullingProgram, "clusterCount"), clusterCount);
+        glUniform1ui(glGetUniformLocation(cullingProgram, "instanceCount"), instanceCount);
+        glUniform1ui(glGetUniformLocation(cullingProgram, "maxInstances"), maxInstances);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clusterBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibleInstanceBuffer);
+
+        // clusters along x in groups of 64, one row of groups per instance
+        if (clusterCount > 0 && instanceCount > 0)
+            glDispatchCompute((clusterCount + 63) / 64, instanceCount, 1);
+
+        // the commands and the instance indices are read by the draws
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        for (GLuint binding = 1; binding <= 3; binding++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    // draws the clusters that passed the last Cull. the instance buffer has to be bound to the binding the vertex shader reads
+    void Draw(Shader &shader)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        for (unsigned int m = 0; m < model.meshes.size(); m++)
+        {
+            Mesh &mesh = model.meshes[m];
+            GLsizei commandCount = (GLsizei)(meshFirstCommand[m + 1] - meshFirstCommand[m]);
+            if (commandCount == 0)
+                continue;
+
+            Mesh::BindTextures(shader, mesh.textures);
+            mesh.SetVertexFormatUniforms(shader);
+            glBindVertexArray(mesh.VAO);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(meshFirstCommand[m] * sizeof(DrawCommand)), commandCount, 0);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        RenderState::instance().activeTexture(0);
+    }
+
+    // radius of a sphere around the model's origin that contains the whole model
+    float InstanceRadius() const
+    {
+        return instanceRadius;
+    }
+
+    unsigned int ClusterCount() const
+    {
+        return clusterCount;
+    }
+
+private:
+    // std430 layout of the clusters in the compute shader
+    struct GpuCluster
+    {
+        glm::vec4 boundingSphere;
+        glm::vec4 normalCone;
+    };
+
+    // the layout glMultiDrawElementsIndirect reads
+    struct DrawCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    Model &model;
+    unsigned int maxInstances;
+    unsigned int clusterCount;
+    float instanceRadius;
+    vector<unsigned int> meshFirstCommand; // first command of every mesh, and the total at the end
+    GLuint clusterBuffer, commandTemplateBuffer, commandBuffer, visibleInstanceBuffer;
+    GLuint cullingProgram;
+
+    static GLuint createComputeProgram(const char *path)
+    {
+        std::ifstream shaderStream(path);
+        std::ostringstream stringStream;
+        stringStream << shaderStream.rdbuf();
+        std::string shaderCodeStr = stringStream.str();
+        const char *shaderCode = shaderCodeStr.c_str();
+
+        GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &shaderCode, nullptr);
+        glCompileShader(computeShader);
+        Shader::checkCompileErrors(computeShader, "COMPUTE");
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, computeShader);
+        glLinkProgram(program);
+        Shader::checkCompileErrors(program, "PROGRAM");
+        glDeleteShader(computeShader);
+        return program;
+    }
+};
+#endif
@@ -2,6 +2,7 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 
+#include <random>
 #include <vector>
 
 // NEW! as our scene gets more complex, we start using more helper classes
@@ -10,6 +11,8 @@
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "cluster_culling.h"
+#include "light_clusters.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -32,14 +35,19 @@ const unsigned int SCR_HEIGHT = 720;
 // -----------------------------------
 Shader* shader;
 Shader* pbr_shading;
+Shader* pbr_shading_clustered; // pbr_shading with CLUSTERED_LIGHTS, all the point lights in one pass
 Model* carPaintModel;
 Model* floorModel;
+ClusterCuller* carCuller; // culls the clusters of every car on the GPU
+LightClusters* lightClusters; // point lights binned into clusters of the view frustum
 Camera camera(glm::vec3(0.0f, 1.6f, 5.0f), glm::vec3(0.0f, 1.0f, 0.0f), (float)SCR_WIDTH / SCR_HEIGHT);
 Camera cullingCamera;
 
 bool updateCulling = true;
 int cullingShader = -1;
 
+unsigned int carTrianglesDrawn = 0;
+
 
 
 
@@ -97,8 +105,20 @@ struct Config
 
     bool enableCulling = true;
 
+    // cull the clusters of every car on the GPU and draw the visible ones with multi draw indirect
+    bool enableClusterCulling = false;
+
+    // levels of detail, picked so that the simplification error stays under lodPixelError pixels
+    bool enableLod = true;
+    float lodPixelError = 1.0f;
+
     // TODO 12.2 : Change the default value to true
     bool enableInstancing = false;
+
+    // shade the point lights in the same pass as light 1, each fragment with the lights of its cluster
+    bool clusteredShading = true;
+    // random point lights added after light 1
+    int extraLightCount = 0;
 } config;
 
 // structure to hold car instances
@@ -118,6 +138,7 @@ void resetForwardAdditionalPass();
 void drawSkybox();
 void drawObjects();
 void drawGui();
+void updateExtraLights();
 unsigned int initSkyboxBuffers();
 unsigned int loadCubemap(vector<std::string> faces);
 
@@ -170,9 +191,12 @@ int main()
     // load the shaders and the 3D models
     // ----------------------------------
     pbr_shading = new Shader("shaders/common_shading.vert", "shaders/pbr_shading.frag");
+    pbr_shading_clustered = new Shader("shaders/common_shading.vert", "shaders/pbr_shading.frag", nullptr, true, {"CLUSTERED_LIGHTS"});
     shader = pbr_shading;
+    lightClusters = new LightClusters();
 
-    carPaintModel = new Model("car/Paint_LOD0.obj");
+    // only LOD0 of the car ships with the assets, the coarser levels are generated while loading
+    carPaintModel = new Model("car/Paint_LOD0.obj", false, VertexFormat::Float, 4);
 
     floorModel = new Model("floor/floor.obj");
 
@@ -182,6 +206,9 @@ int main()
     // create compute shader for frustum culling on GPU
     createCullingCompute();
 
+    // the car paint was split into clusters when it was loaded
+    carCuller = new ClusterCuller(*carPaintModel, (unsigned int)cars.size());
+
 
     // init skybox
     vector<std::string> faces
@@ -231,28 +258,46 @@ int main()
         glm::mat4 viewProjection = projection * view;
 
         processInput(window);
+        updateExtraLights();
 
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         drawSkybox();
 
+        // the clustered shader adds the other lights to the pass of the first one, the scene is drawn once
+        bool clustered = config.clusteredShading && config.lights.size() > 1;
+        shader = clustered ? pbr_shading_clustered : pbr_shading;
         shader->use();
 
 
         // First light + ambient
         setAmbientUniforms(glm::vec3(1.0f));
         setLightUniforms(config.lights[0]);
+        if (clustered)
+        {
+            lightClusters->Clear();
+            for (int i = 1; i < config.lights.size(); ++i)
+            {
+                const Light &light = config.lights[i];
+                lightClusters->AddLight(light.position, light.radius, light.color * light.intensity * glm::pi<float>());
+            }
+            lightClusters->Build(view, projection, camera.Near, camera.Far);
+            lightClusters->Bind(*shader, 7);
+        }
         drawObjects();
 
         // Additional additive lights
-        setupForwardAdditionalPass();
-        for (int i = 1; i < config.lights.size(); ++i)
+        if (!clustered)
         {
-            setLightUniforms(config.lights[i]);
-            drawObjects();
+            setupForwardAdditionalPass();
+            for (int i = 1; i < config.lights.size(); ++i)
+            {
+                setLightUniforms(config.lights[i]);
+                drawObjects();
+            }
+            resetForwardAdditionalPass();
         }
-        resetForwardAdditionalPass();
 
         drawGui();
 
@@ -266,9 +311,12 @@ int main()
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
+    delete carCuller;
     delete carPaintModel;
     delete floorModel;
+    delete lightClusters;
     delete pbr_shading;
+    delete pbr_shading_clustered;
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -291,6 +339,10 @@ void drawGui(){
         ImGui::DragFloat3("light 1 direction", (float*)&config.lights[0].position, .1f, -20, 20);
         ImGui::ColorEdit3("light 1 color", (float*)&config.lights[0].color);
         ImGui::SliderFloat("light 1 intensity", &config.lights[0].intensity, 0.0f, 2.0f);
+        ImGui::SliderInt("extra point lights", &config.extraLightCount, 0, 4096);
+        ImGui::Checkbox("clustered shading", &config.clusteredShading);
+        if (config.clusteredShading)
+            ImGui::Text("%u light indices in %u clusters", lightClusters->IndexCount(), lightClusters->ClusterCount());
         ImGui::Separator();
 
         ImGui::Text("Car paint material: ");
@@ -300,12 +352,17 @@ void drawGui(){
 
         ImGui::Checkbox("Frustum Culling", &config.enableCulling);
         ImGui::Checkbox("Instancing",  &config.enableInstancing);
+        ImGui::Checkbox("Cluster Culling", &config.enableClusterCulling);
+        ImGui::Text("%u clusters per car", carCuller->ClusterCount());
+        ImGui::Checkbox("Levels of detail", &config.enableLod);
+        ImGui::SliderFloat("LOD pixel error", &config.lodPixelError, 0.1f, 10.0f);
 
         ImGui::End();
     }
 
     ImGui::Begin("FPS", nullptr, ImGuiWindowFlags_NoDecoration);
     ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::Text("Car triangles %u", carTrianglesDrawn);
     ImGui::End();
 
     glDisable(GL_FRAMEBUFFER_SRGB);
@@ -316,6 +373,25 @@ void drawGui(){
 }
 
 
+void updateExtraLights()
+{
+    // light 1 comes first, the extra ones are added or removed at the end
+    const size_t lightCount = 1 + (size_t)std::max(config.extraLightCount, 0);
+    if (config.lights.size() > lightCount)
+        config.lights.erase(config.lights.begin() + lightCount, config.lights.end());
+
+    // scattered between the cars, each one placed from its index so it stays where it was when the count changes
+    while (config.lights.size() < lightCount)
+    {
+        // braces evaluate the draws left to right, the order of unspecified argument evaluation would differ per compiler
+        std::mt19937 random((unsigned int)config.lights.size());
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        glm::vec3 position{unit(random) * 160.0f - 80.0f, 0.5f + unit(random) * 2.0f, unit(random) * 150.0f - 75.0f};
+        glm::vec3 color{unit(random), unit(random), unit(random)};
+        config.lights.emplace_back(position, color, 2.0f, 2.0f + unit(random) * 4.0f);
+    }
+}
+
 void setAmbientUniforms(glm::vec3 ambientLightColor)
 {
     // ambient uniforms
@@ -439,33 +515,42 @@ unsigned int initSkyboxBuffers() {
 // -------------------------------------------------------
 unsigned int loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrComponents;
+    // the six faces are converted once into a container with all their mip levels, later runs only map it
+    std::string containerFile = TextureContainer::containerPath(faces[0] + ".cube", true);
+    bool upToDate = true;
     for (unsigned int i = 0; i < faces.size(); i++)
+        upToDate = upToDate && TextureContainer::isUpToDate(containerFile, faces[i]);
+
+    TextureContainer container;
+    if (!upToDate || !container.load(containerFile))
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        // decode the six faces in parallel
+        vector<DecodedImage> images = ImageDecoder::decode(faces, 3);
+        bool complete = true;
+        for (unsigned int i = 0; i < images.size(); i++)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_SRGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            if (!images[i].data)
+            {
+                std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+                complete = false;
+            }
         }
-        else
+        if (complete)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            container = TextureContainer::fromImages(images, true, TextureContainer::defaultCompression(3));
+            container.write(containerFile);
         }
+        for (unsigned int i = 0; i < images.size(); i++)
+            images[i].free();
     }
+
+    unsigned int textureID = container.upload();
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
     return textureID;
@@ -525,15 +610,43 @@ void drawObjects()
         cullingCamera = camera;
 
     // Draw all cars
-    if (!config.enableInstancing)
+    carTrianglesDrawn = 0;
+    if (config.enableClusterCulling)
     {
+        carCuller->Cull(cullingCamera, sourceInstanceBuffer, (unsigned int)cars.size());
+        shader->use();
+
+        // the vertex shader takes the model matrix and color of every instance from the instance buffer
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sourceInstanceBuffer);
+        shader->setMat4("model", glm::mat4(1.0f));
+        shader->setBool("clusterInstances", true);
+        carCuller->Draw(*shader);
+        shader->setBool("clusterInstances", false);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    }
+    else if (!config.enableInstancing)
+    {
+        // resolve the uniform locations once, instead of looking up the names for every car
+        GLint modelLocation = shader->getUniformLocation("model");
+        GLint reflectionColorLocation = shader->getUniformLocation("reflectionColor");
+
+        // pixels covered by one unit at distance 1, to project the error of the levels of detail on the screen
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        float projectionScale = (float)viewport[3] / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
+
         for (const Car& car : cars)
         {
             // TODO 12.1 : Only execute this block if culling is not enabled or if the bounding sphere is visible in cullingCamera
             {
-                shader->setMat4("model", car.modelMatrix);
-                shader->setVec4("reflectionColor", car.color);
-                carPaintModel->Draw(*shader);
+                unsigned int lod = 0;
+                if (config.enableLod)
+                    lod = carPaintModel->SelectLod(glm::distance(camera.Position, glm::vec3(car.modelMatrix[3])), projectionScale, config.lodPixelError);
+
+                shader->setMat4(modelLocation, car.modelMatrix);
+                shader->setVec4(reflectionColorLocation, car.color);
+                carPaintModel->Draw(*shader, 1, 0, lod);
+                carTrianglesDrawn += carPaintModel->TriangleCount(lod);
             }
         }
     }
@@ -667,7 +780,7 @@ void runCullingCompute()
         cullingCamera.GetFrustumPlane((Camera_Planes)plane, planes[plane * 2], planes[plane * 2 + 1]);
     }
     // Pass the uniforms
-    glUniform1f(glGetUniformLocation(cullingShader, "cullingRadius"), 2.5f);
+    glUniform1f(glGetUniformLocation(cullingShader, "cullingRadius"), carCuller->InstanceRadius());
     glUniform3fv(glGetUniformLocation(cullingShader, "frustumPlanes"), 6 * 2, (const float*)planes);
 
     // Bind the buffers:
@@ -6,12 +6,18 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <mesh_optimizer.h>
+#include <render_state.h>
 #include <shader.h>
+#include <upload_queue.h>
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
@@ -28,60 +34,91 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// layout of the vertices in the vertex buffer. the packed layouts keep the same attribute locations, but the normal
+// and tangent are octahedral encoded and the bitangent is only a sign, so the vertex shader has to decode them
+enum class VertexFormat
+{
+    Float,          // Vertex, 56 bytes
+    Packed,         // PackedVertex, 28 bytes
+    PackedQuantized // QuantizedVertex, 24 bytes
+};
+
+struct PackedVertex {
+    // position
+    glm::vec3 Position;
+    // normal, octahedral encoded as snorm16
+    short Normal[2];
+    // texCoords, two half floats
+    unsigned int TexCoords;
+    // tangent, octahedral encoded as snorm16, followed by the bitangent sign and padding
+    short Tangent[4];
+};
+
+struct QuantizedVertex {
+    // position, unorm16 relative to the mesh bounds, followed by padding
+    unsigned short Position[4];
+    // normal, octahedral encoded as snorm16
+    short Normal[2];
+    // texCoords, two half floats
+    unsigned int TexCoords;
+    // tangent, octahedral encoded as snorm16, followed by the bitangent sign and padding
+    short Tangent[4];
+};
+
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// a simplified version of the mesh, drawn with the same vertices
+struct MeshLod {
+    vector<unsigned int> indices;
+    // largest distance between the simplified and the full detail surface, in model units
+    float error;
+};
+
 class Mesh {
 public:
     /*  Mesh Data  */
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
+    vector<MeshLod> lods; // levels of detail 1 to N, level 0 draws indices
+    vector<MeshCluster> clusters; // ranges of indices with their culling data
     unsigned int VAO;
+    VertexFormat format;
 
     /*  Functions  */
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, VertexFormat format = VertexFormat::Float, vector<MeshLod> lods = vector<MeshLod>(), vector<MeshCluster> clusters = vector<MeshCluster>())
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->format = format;
+        this->lods = lods;
+        this->clusters = clusters;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
     // render the mesh
-    void Draw(Shader shader, GLsizei instanceCount = 1, unsigned int indirectBuffer = 0)
+    void Draw(Shader &shader, GLsizei instanceCount = 1, unsigned int indirectBuffer = 0, unsigned int lod = 0)
     {
+        // meshes whose buffers are still streaming in aren't drawn yet
+        if (!Uploaded())
+            return;
+
         // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int ambientNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-            else if(name == "texture_ambient")
-                number = std::to_string(ambientNr++); // transfer unsigned int to stream
+        BindTextures(shader, textures);
+        SetVertexFormatUniforms(shader);
 
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
+        // the levels of detail follow the full detail indices in the element buffer, levels the mesh doesn't have use its coarsest one
+        unsigned int level = std::min(lod, (unsigned int)lods.size());
+        GLsizei indexCount = (GLsizei)(level == 0 ? indices.size() : lods[level - 1].indices.size());
+        const void *firstIndex = (const void*)(lodOffsets[level] * sizeof(unsigned int));
 
         // draw mesh
         glBindVertexArray(VAO);
@@ -98,20 +135,79 @@ public:
         else
         {
             // TODO 12.2 : if instance count is greater than one, we want to use glDrawElementsInstanced instead
-            glDrawElements(GL_TRIANGLES, (int)indices.size(), GL_UNSIGNED_INT, 0);
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, firstIndex);
         }
 
         glBindVertexArray(0);
 
         // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        RenderState::instance().activeTexture(0);
+    }
+
+    // binds the textures to consecutive units and points the samplers at them, named as in Model::processMesh
+    static void BindTextures(Shader &shader, const vector<Texture> &textures)
+    {
+        unsigned int diffuseNr  = 1;
+        unsigned int specularNr = 1;
+        unsigned int normalNr   = 1;
+        unsigned int ambientNr   = 1;
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            // retrieve texture number (the N in diffuse_textureN), types without a number keep the bare name
+            unsigned int number = 0;
+            const string &name = textures[i].type;
+            if(name == "texture_diffuse")
+                number = diffuseNr++;
+            else if(name == "texture_specular")
+                number = specularNr++;
+            else if(name == "texture_normal")
+                number = normalNr++;
+            else if(name == "texture_ambient")
+                number = ambientNr++;
+
+            // now set the sampler to the correct texture unit
+            shader.setInt(samplerName(name, number), i);
+            // and finally bind the texture, the render state skips it when the unit already holds it
+            RenderState::instance().bindTexture(i, GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
+    // false while the upload queue is still streaming the buffers of the mesh
+    bool Uploaded() const
+    {
+        return *uploaded;
+    }
+
+    // tells the shader how to decode the vertices
+    void SetVertexFormatUniforms(Shader &shader)
+    {
+        shader.setBool("packedVertices", format != VertexFormat::Float);
+        shader.setVec3("positionOffset", positionOffset);
+        shader.setVec3("positionScale", positionScale);
     }
 
 private:
     /*  Render data  */
     unsigned int VBO, EBO;
+    vector<size_t> lodOffsets; // first index of every level of detail in the element buffer
+    std::shared_ptr<bool> uploaded; // shared by the copies of the mesh, the upload queue sets it when the buffers have landed
+    // quantized positions are stored relative to the mesh bounds: position = positionOffset + stored * positionScale
+    glm::vec3 positionOffset, positionScale;
 
     /*  Functions    */
+    // the name of the number-th sampler of a texture type, built once and kept so drawing doesn't build strings
+    static const string& samplerName(const string &type, unsigned int number)
+    {
+        static map<string, vector<string> > names;
+        vector<string> &typeNames = names[type];
+        while (typeNames.size() <= number)
+        {
+            unsigned int n = (unsigned int)typeNames.size();
+            typeNames.push_back(n == 0 ? type : type + std::to_string(n));
+        }
+        return typeNames[number];
+    }
+
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
@@ -121,34 +217,158 @@ private:
         glGenBuffers(1, &EBO);
 
         glBindVertexArray(VAO);
-        // load data into vertex buffers
+        // load data into vertex buffers. the buffers get their storage now, and the data through the upload queue,
+        // which copies it right away unless it streams
+        UploadQueue &queue = UploadQueue::instance();
+        uploaded = std::make_shared<bool>(false);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        positionOffset = glm::vec3(0.0f);
+        positionScale = glm::vec3(1.0f);
+        if (format == VertexFormat::Float)
+        {
+            // A great thing about structs is that their memory layout is sequential for all its items.
+            // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+            // again translates to 3/2 floats which translates to a byte array.
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+            queue.uploadBuffer(VBO, 0, &vertices[0], vertices.size() * sizeof(Vertex));
+        }
+        else if (format == VertexFormat::Packed)
+        {
+            vector<PackedVertex> packedVertices(vertices.size());
+            for (unsigned int i = 0; i < vertices.size(); i++)
+            {
+                packedVertices[i].Position = vertices[i].Position;
+                packAttributes(vertices[i], packedVertices[i]);
+            }
+            glBufferData(GL_ARRAY_BUFFER, packedVertices.size() * sizeof(PackedVertex), NULL, GL_STATIC_DRAW);
+            queue.uploadBuffer(VBO, 0, &packedVertices[0], packedVertices.size() * sizeof(PackedVertex));
+        }
+        else
+        {
+            glm::vec3 minPosition = vertices[0].Position, maxPosition = vertices[0].Position;
+            for (unsigned int i = 1; i < vertices.size(); i++)
+            {
+                minPosition = glm::min(minPosition, vertices[i].Position);
+                maxPosition = glm::max(maxPosition, vertices[i].Position);
+            }
+            positionOffset = minPosition;
+            positionScale = maxPosition - minPosition;
+
+            vector<QuantizedVertex> quantizedVertices(vertices.size());
+            for (unsigned int i = 0; i < vertices.size(); i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    float relative = positionScale[c] > 0.0f ? (vertices[i].Position[c] - positionOffset[c]) / positionScale[c] : 0.0f;
+                    quantizedVertices[i].Position[c] = (unsigned short)(glm::clamp(relative, 0.0f, 1.0f) * 65535.0f + 0.5f);
+                }
+                quantizedVertices[i].Position[3] = 0;
+                packAttributes(vertices[i], quantizedVertices[i]);
+            }
+            glBufferData(GL_ARRAY_BUFFER, quantizedVertices.size() * sizeof(QuantizedVertex), NULL, GL_STATIC_DRAW);
+            queue.uploadBuffer(VBO, 0, &quantizedVertices[0], quantizedVertices.size() * sizeof(QuantizedVertex));
+        }
 
+        // the element buffer holds the full detail indices followed by the ones of every level of detail
+        lodOffsets.assign(1, 0);
+        size_t indexCount = indices.size();
+        for (unsigned int i = 0; i < lods.size(); i++)
+        {
+            lodOffsets.push_back(indexCount);
+            indexCount += lods[i].indices.size();
+        }
+        vector<unsigned int> elements(indices);
+        for (unsigned int i = 0; i < lods.size(); i++)
+            elements.insert(elements.end(), lods[i].indices.begin(), lods[i].indices.end());
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+        // the queue is first in first out, so the mesh is complete once the element buffer has landed
+        std::shared_ptr<bool> landed = uploaded;
+        queue.uploadBuffer(EBO, 0, &elements[0], elements.size() * sizeof(unsigned int), [landed]() { *landed = true; });
 
         // set the vertex attribute pointers
+        if (format == VertexFormat::Float)
+        {
+            // vertex Positions
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+            // vertex normals
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+            // vertex texture coords
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+            // vertex tangent
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+            // vertex bitangent
+            glEnableVertexAttribArray(4);
+            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        }
+        else if (format == VertexFormat::Packed)
+            setupPackedAttributes<PackedVertex>(GL_FLOAT, GL_FALSE);
+        else
+            setupPackedAttributes<QuantizedVertex>(GL_UNSIGNED_SHORT, GL_TRUE);
+
+        glBindVertexArray(0);
+    }
+
+    // vertex attribute pointers of the packed layouts. there is no bitangent attribute, the shader rebuilds it from the sign
+    template <typename PackedType>
+    void setupPackedAttributes(GLenum positionType, GLboolean positionNormalized)
+    {
         // vertex Positions
         glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        glVertexAttribPointer(0, 3, positionType, positionNormalized, sizeof(PackedType), (void*)offsetof(PackedType, Position));
         // vertex normals
         glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedType), (void*)offsetof(PackedType, Normal));
         // vertex texture coords
         glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedType), (void*)offsetof(PackedType, TexCoords));
+        // vertex tangent and bitangent sign
         glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        glVertexAttribPointer(3, 3, GL_SHORT, GL_TRUE, sizeof(PackedType), (void*)offsetof(PackedType, Tangent));
+    }
 
-        glBindVertexArray(0);
+    // fills the attributes shared by the packed layouts
+    template <typename PackedType>
+    static void packAttributes(const Vertex &vertex, PackedType &packed)
+    {
+        glm::vec2 normal = octahedralEncode(vertex.Normal);
+        packed.Normal[0] = toSnorm16(normal.x);
+        packed.Normal[1] = toSnorm16(normal.y);
+
+        packed.TexCoords = glm::packHalf2x16(vertex.TexCoords);
+
+        glm::vec2 tangent = octahedralEncode(vertex.Tangent);
+        float bitangentSign = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+        packed.Tangent[0] = toSnorm16(tangent.x);
+        packed.Tangent[1] = toSnorm16(tangent.y);
+        packed.Tangent[2] = toSnorm16(bitangentSign);
+        packed.Tangent[3] = 0;
+    }
+
+    // maps a unit vector to the [-1, 1] square by projecting it on an octahedron and unfolding the lower half
+    static glm::vec2 octahedralEncode(glm::vec3 v)
+    {
+        float length = glm::abs(v.x) + glm::abs(v.y) + glm::abs(v.z);
+        if (length == 0.0f)
+            return glm::vec2(0.0f);
+        v /= length;
+        glm::vec2 encoded(v.x, v.y);
+        if (v.z < 0.0f)
+        {
+            encoded.x = (1.0f - glm::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f);
+            encoded.y = (1.0f - glm::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return encoded;
+    }
+
+    static short toSnorm16(float value)
+    {
+        return (short)glm::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
     }
 };
 #endif
\ No newline at end of file
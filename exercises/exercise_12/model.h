@@ -5,6 +5,7 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <texture_container.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #include <assimp/Importer.hpp>
@@ -12,49 +13,249 @@
 #include <assimp/postprocess.h>
 
 #include <mesh.h>
+#include <mesh_optimizer.h>
+#include <mesh_simplifier.h>
 #include <shader.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false, bool normalMap = false);
+TextureContainer ContainerFromFile(const string &filename, bool gamma = false, bool normalMap = false);
+unsigned int TextureFromContainer(const TextureContainer &container);
+
+// process-wide cache of the textures loaded from disk, shared by all the models.
+// textures are reference counted and deleted when the last model using them is destroyed
+class TextureCache
+{
+public:
+    static TextureCache& instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // a file to prefetch, relative to the model's directory, with the flags it will be acquired with
+    struct Request
+    {
+        string path;
+        bool gamma;
+        bool normalMap;
+    };
+
+    // returns the texture stored at directory/path, loading it only the first time it is requested
+    unsigned int acquire(const char *path, const string &directory, bool gamma = false, bool normalMap = false)
+    {
+        string key = textureKey(directory + '/' + path, gamma, normalMap);
+
+        unordered_map<string, Entry>::iterator it = entries.find(key);
+        if (it == entries.end())
+        {
+            Entry entry;
+            unordered_map<string, TextureContainer>::iterator container = prefetched.find(key);
+            if (container != prefetched.end())
+            {
+                // already converted or mapped by prefetch, only the upload is left
+                entry.id = TextureFromContainer(container->second);
+                prefetched.erase(container);
+            }
+            else
+                entry.id = TextureFromFile(path, directory, gamma, normalMap);
+            // files that failed to load aren't cached
+            if (entry.id == 0)
+                return 0;
+            entry.refCount = 0;
+            it = entries.insert(std::make_pair(key, entry)).first;
+            keys[entry.id] = key;
+        }
+        it->second.refCount++;
+        return it->second.id;
+    }
+
+    // drops one reference to the texture, deleting it when nobody is using it anymore
+    void release(unsigned int id)
+    {
+        unordered_map<unsigned int, string>::iterator keyIt = keys.find(id);
+        if (keyIt == keys.end())
+            return;
+
+        unordered_map<string, Entry>::iterator it = entries.find(keyIt->second);
+        if (--it->second.refCount == 0)
+        {
+            glDeleteTextures(1, &id);
+            // the name may still be shadowed as bound, and a new texture can get it
+            RenderState::instance().invalidate();
+            entries.erase(it);
+            keys.erase(keyIt);
+        }
+    }
+
+    // loads, in parallel, the containers of the files that aren't cached yet. the following acquire calls only have to upload them
+    void prefetch(const vector<Request> &files, const string &directory)
+    {
+        vector<string> paths, pathKeys;
+        vector<bool> gammas, normalMaps;
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            string path = directory + '/' + files[i].path;
+            string key = textureKey(path, files[i].gamma, files[i].normalMap);
+            if (entries.count(key) || prefetched.count(key))
+                continue;
+            prefetched[key] = TextureContainer();
+            paths.push_back(path);
+            pathKeys.push_back(key);
+            gammas.push_back(files[i].gamma);
+            normalMaps.push_back(files[i].normalMap);
+        }
+
+        // the workers can't use OpenGL, so the supported formats are queried from this thread first
+        TextureContainer::supportsS3TC();
+
+        vector<TextureContainer> containers(paths.size());
+        ImageDecoder::parallelFor(paths.size(), [&containers, &paths, &gammas, &normalMaps](size_t i)
+        {
+            containers[i] = ContainerFromFile(paths[i], gammas[i], normalMaps[i]);
+        });
+        for (size_t i = 0; i < containers.size(); i++)
+            prefetched[pathKeys[i]] = std::move(containers[i]);
+    }
+
+    // unmaps the prefetched containers that were never acquired
+    void discardPrefetched()
+    {
+        prefetched.clear();
+    }
+
+    // number of distinct textures currently alive
+    size_t size() const { return entries.size(); }
+
+    // the same image uploaded as sRGB, linear or as a normal map results in different textures
+    static string textureKey(const string &path, bool gamma, bool normalMap)
+    {
+        return canonicalPath(path) + (gamma ? "#srgb" : "") + (normalMap ? "#normal" : "");
+    }
+
+    // lexically normalizes a path (separators, "." and ".."), so different spellings of the same file share an entry
+    static string canonicalPath(const string &path)
+    {
+        string unified = path;
+        for (size_t i = 0; i < unified.size(); i++)
+            if (unified[i] == '\\')
+                unified[i] = '/';
+
+        vector<string> parts;
+        stringstream stream(unified);
+        string part;
+        while (std::getline(stream, part, '/'))
+        {
+            if (part.empty() || part == ".")
+                continue;
+            if (part == ".." && !parts.empty() && parts.back() != "..")
+                parts.pop_back();
+            else
+                parts.push_back(part);
+        }
+
+        string canonical = !unified.empty() && unified[0] == '/' ? "/" : "";
+        for (size_t i = 0; i < parts.size(); i++)
+            canonical += (i > 0 ? "/" : "") + parts[i];
+        return canonical;
+    }
+
+private:
+    struct Entry
+    {
+        unsigned int id;
+        unsigned int refCount;
+    };
+
+    TextureCache() {}
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    unordered_map<string, Entry> entries;   // canonical path -> texture
+    unordered_map<unsigned int, string> keys; // texture id -> canonical path, used when releasing
+    unordered_map<string, TextureContainer> prefetched; // containers waiting to be uploaded
+};
 
 class Model
 {
 public:
     /*  Model Data */
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    unordered_map<string, Texture> textures_loaded;	// textures used by this model, by path. each one holds a reference in the TextureCache
     vector<Mesh> meshes;
     string directory;
     bool gammaCorrection;
+    VertexFormat vertexFormat;
+    unsigned int lodLevels; // simplified levels generated for every mesh
+    vector<float> lodErrors; // error of every level of detail, the largest of all meshes, in model units. level 0 is exact
 
     /*  Functions   */
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor, expects a filepath to a 3D model. the meshes are uploaded with the given vertex layout,
+    // and get up to lodCount simplified levels of detail, each with half the triangles of the previous one
+    Model(string const &path, bool gamma = false, VertexFormat format = VertexFormat::Float, unsigned int lodCount = 0) : gammaCorrection(gamma), vertexFormat(format), lodLevels(lodCount)
     {
         loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader shader, GLsizei instanceCount = 1, unsigned int indirectBuffer = 0)
+    // releases this model's references to the shared textures
+    ~Model()
+    {
+        for (unordered_map<string, Texture>::iterator it = textures_loaded.begin(); it != textures_loaded.end(); ++it)
+            TextureCache::instance().release(it->second.id);
+    }
+
+    // models own texture references, so they can't be copied
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    // draws the model, and thus all its meshes, at the given level of detail
+    void Draw(Shader &shader, GLsizei instanceCount = 1, unsigned int indirectBuffer = 0, unsigned int lod = 0)
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader, instanceCount, indirectBuffer);
+            meshes[i].Draw(shader, instanceCount, indirectBuffer, lod);
+    }
+
+    // picks the coarsest level of detail whose error covers at most maxPixelError pixels on screen. distance goes from the
+    // camera to the model, projectionScale is the viewport height divided by 2 * tan(fovy / 2), the pixels per unit at distance 1
+    unsigned int SelectLod(float distance, float projectionScale, float maxPixelError = 1.0f) const
+    {
+        unsigned int lod = 0;
+        while (lod + 1 < lodErrors.size() && lodErrors[lod + 1] * projectionScale <= maxPixelError * distance)
+            lod++;
+        return lod;
+    }
+
+    // number of triangles drawn at the given level of detail
+    unsigned int TriangleCount(unsigned int lod = 0) const
+    {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            unsigned int level = std::min(lod, (unsigned int)meshes[i].lods.size());
+            count += (unsigned int)(level == 0 ? meshes[i].indices.size() : meshes[i].lods[level - 1].indices.size()) / 3;
+        }
+        return count;
     }
 
 private:
+    // vertex cache statistics of the meshes processed so far, reported once the model is loaded
+    unsigned int optimizedTriangles, optimizedVertices, transformsBefore, transformsAfter;
+
     /*  Functions   */
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
@@ -64,8 +265,58 @@ private:
         // retrieve the directory path of the filepath
         directory = path.substr(0, path.find_last_of('/'));
 
+        // decode all the textures of the model at once, on worker threads
+        prefetchTextures(scene);
+
         // process ASSIMP's root node recursively
+        optimizedTriangles = optimizedVertices = transformsBefore = transformsAfter = 0;
         processNode(scene->mRootNode, scene);
+        if (optimizedTriangles > 0)
+            cout << "Optimized " << path << ": ACMR " << (float)transformsBefore / optimizedTriangles << " -> " << (float)transformsAfter / optimizedTriangles
+                 << ", ATVR " << (float)transformsBefore / optimizedVertices << " -> " << (float)transformsAfter / optimizedVertices << endl;
+
+        // the error of a level is the worst of its meshes, a mesh that stopped simplifying early draws its coarsest level
+        lodErrors.assign(1, 0.0f);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            for (unsigned int level = 1; level <= meshes[i].lods.size(); level++)
+            {
+                if (lodErrors.size() <= level)
+                    lodErrors.push_back(lodErrors.back());
+                lodErrors[level] = std::max(lodErrors[level], meshes[i].lods[level - 1].error);
+            }
+        }
+        for (unsigned int level = 1; level < lodErrors.size(); level++)
+        {
+            lodErrors[level] = std::max(lodErrors[level], lodErrors[level - 1]);
+            cout << "LOD" << level << " of " << path << ": " << TriangleCount(level) << " of " << TriangleCount(0) << " triangles, error " << lodErrors[level] << endl;
+        }
+
+        TextureCache::instance().discardPrefetched();
+    }
+
+    // gathers the textures referenced by the materials of the model's meshes and hands them to the cache,
+    // so they are decoded in parallel instead of one at a time while the meshes are processed
+    void prefetchTextures(const aiScene *scene)
+    {
+        const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+
+        vector<TextureCache::Request> files;
+        for(unsigned int i = 0; i < scene->mNumMeshes; i++)
+        {
+            aiMaterial* material = scene->mMaterials[scene->mMeshes[i]->mMaterialIndex];
+            for(unsigned int t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+            {
+                for(unsigned int j = 0; j < material->GetTextureCount(types[t]); j++)
+                {
+                    aiString str;
+                    material->GetTexture(types[t], j, &str);
+                    TextureCache::Request request = { string(str.C_Str()), false, types[t] == aiTextureType_HEIGHT };
+                    files.push_back(request);
+                }
+            }
+        }
+        TextureCache::instance().prefetch(files, directory);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -163,8 +414,66 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ambient");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
+        optimizeMesh(vertices, indices);
+        vector<MeshLod> lods = generateLods(vertices, indices);
+        vector<MeshCluster> clusters = MeshOptimizer::buildClusters(indices, vertices);
+
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return Mesh(vertices, indices, textures, vertexFormat, lods, clusters);
+    }
+
+    // simplifies the mesh into levels with half the triangles of the previous one. the allowed error doubles with every level,
+    // starting at a fraction of the mesh size, and the chain ends early once a level can't get rid of enough triangles
+    vector<MeshLod> generateLods(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+    {
+        const float firstLodError = 0.005f; // relative to the radius of the mesh
+        const float minReduction = 0.8f;    // a level has to keep at most this much of the previous one
+
+        vector<MeshLod> lods;
+        if (lodLevels == 0 || indices.empty())
+            return lods;
+
+        glm::vec3 minPosition = vertices[0].Position, maxPosition = vertices[0].Position;
+        for (unsigned int i = 1; i < vertices.size(); i++)
+        {
+            minPosition = glm::min(minPosition, vertices[i].Position);
+            maxPosition = glm::max(maxPosition, vertices[i].Position);
+        }
+        float radius = glm::length(maxPosition - minPosition) * 0.5f;
+
+        size_t previousCount = indices.size();
+        for (unsigned int level = 1; level <= lodLevels; level++)
+        {
+            // every level starts from the full detail mesh, so its error is measured against the original surface
+            size_t targetCount = indices.size() / 3 / ((size_t)1 << level) * 3;
+            float maxError = firstLodError * radius * (float)(1 << (level - 1));
+            MeshLod lod;
+            lod.indices = MeshSimplifier::simplify(vertices, indices, targetCount, maxError, &lod.error);
+            if (lod.indices.empty() || lod.indices.size() > previousCount * minReduction)
+                break;
+            MeshOptimizer::optimizeVertexCache(lod.indices, (unsigned int)vertices.size());
+            previousCount = lod.indices.size();
+            lods.push_back(lod);
+        }
+        return lods;
+    }
+
+    // reorders the mesh for the post-transform vertex cache, then for overdraw, then for vertex fetch,
+    // and adds the cache efficiency before and after to the model's totals
+    void optimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        unsigned int vertexCount = (unsigned int)vertices.size();
+        MeshOptimizer::CacheStats before = MeshOptimizer::analyzeVertexCache(indices, vertexCount);
+
+        MeshOptimizer::optimizeVertexCache(indices, vertexCount);
+        MeshOptimizer::optimizeOverdraw(indices, vertices);
+        MeshOptimizer::optimizeVertexFetch(vertices, indices);
+
+        MeshOptimizer::CacheStats after = MeshOptimizer::analyzeVertexCache(indices, (unsigned int)vertices.size());
+        optimizedTriangles += before.triangles;
+        optimizedVertices += before.vertices;
+        transformsBefore += before.transforms;
+        transformsAfter += after.transforms;
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -176,73 +485,68 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
+            // check if this model already uses the texture; if not, get it from the shared cache, which
+            // only loads it from disk if no other model has loaded it before
+            unordered_map<string, Texture>::iterator it = textures_loaded.find(str.C_Str());
+            if (it == textures_loaded.end())
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory, type == aiTextureType_DIFFUSE);
+                texture.id = TextureCache::instance().acquire(str.C_Str(), this->directory, false, type == aiTextureType_HEIGHT);
                 texture.type = typeName;
                 texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+                it = textures_loaded.insert(std::make_pair(texture.path, texture)).first;
             }
+            textures.push_back(it->second);
         }
         return textures;
     }
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, bool normalMap)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    return TextureFromContainer(ContainerFromFile(filename, gamma, normalMap));
+}
+
+// returns the GPU-ready version of an image file. the first time, the file is converted (all the mip levels, block
+// compressed unless TextureContainer::setCompression turned it off, normal maps in BC5) and the container is saved in the
+// texture cache folder; after that the container is only mapped. doesn't use OpenGL, so it can run on worker threads
+TextureContainer ContainerFromFile(const string &filename, bool gamma, bool normalMap)
+{
+    TextureContainer container;
+    string containerFile = TextureContainer::containerPath(filename, gamma, normalMap);
+    if (TextureContainer::isUpToDate(containerFile, filename) && container.load(containerFile))
+        return container;
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    vector<DecodedImage> images(1, ImageDecoder::decodeFile(filename));
+    if (images[0].data)
     {
-        GLenum format, internalFormat;
-        if (nrComponents == 1)
-            internalFormat = format = GL_RED;
-        else if (nrComponents == 3)
-        {
-            format = GL_RGB;
-            internalFormat = gamma ? GL_SRGB : format;
-        }
-        else if (nrComponents == 4)
-        {
-            format = GL_RGBA;
-            internalFormat = gamma ? GL_SRGB_ALPHA : format;
-        }
+        TextureContainer::Compression compression = TextureContainer::defaultCompression(images[0].components, normalMap);
+        container = TextureContainer::fromImages(images, gamma, compression);
+        container.write(containerFile);
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << filename << std::endl;
+    }
+    images[0].free();
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    return container;
+}
 
+// uploads the container as a repeating, trilinear filtered texture. returns 0 if the container is empty
+unsigned int TextureFromContainer(const TextureContainer &container)
+{
+    unsigned int textureID = container.upload();
+    if (textureID != 0)
+    {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
     }
 
     return textureID;
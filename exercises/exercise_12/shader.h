@@ -5,10 +5,16 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <program_cache.h>
+
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 class Shader
 {
@@ -17,61 +23,49 @@ public:
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+        : Shader(vertexPath, fragmentPath, geometryPath, true)
+    {
+    }
+    // with wait set to false the program is only submitted to the driver, and Finish() checks it later. a driver that
+    // compiles in the background works on every program submitted before the first Finish() at the same time.
+    // every define, "NAME" or "NAME value", is added to each stage, to build a permutation of the sources
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath, bool wait,
+           const std::vector<std::string> &defines = std::vector<std::string>()) : finished(false)
     {
-        // 1. retrieve the vertex/fragment source code from filePath
+        // 1. retrieve the vertex/fragment source code from filePath, with the includes resolved and the defines added
         std::string vertexCode;
         std::string fragmentCode;
         std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-            // if geometry shader path is present, also load a geometry shader
-            if (geometryPath != nullptr)
-            {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure e)
+        preprocess(vertexPath, defines, vertexCode);
+        preprocess(fragmentPath, defines, fragmentCode);
+        // if geometry shader path is present, also load a geometry shader
+        if (geometryPath != nullptr)
+            preprocess(geometryPath, defines, geometryCode);
+        // 2. load the program binary a previous run stored for these sources, compile them only when there is none
+        ProgramCache &programCache = ProgramCache::instance();
+        programKey = programCache.key({ vertexCode, fragmentCode, geometryCode });
+        ID = programCache.load(programKey);
+        if (ID != 0)
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            loadActiveUniforms();
+            finished = true;
+            return;
         }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+        // 3. compile shaders
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+        pendingShaders.push_back(std::make_pair(vertex, "VERTEX"));
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        pendingShaders.push_back(std::make_pair(fragment, "FRAGMENT"));
         // if geometry shader is given, compile geometry shader
         unsigned int geometry;
         if (geometryPath != nullptr)
@@ -80,7 +74,7 @@ public:
             geometry = glCreateShader(GL_GEOMETRY_SHADER);
             glShaderSource(geometry, 1, &gShaderCode, NULL);
             glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            pendingShaders.push_back(std::make_pair(geometry, "GEOMETRY"));
         }
         // shader Program
         ID = glCreateProgram();
@@ -88,14 +82,45 @@ public:
         glAttachShader(ID, fragment);
         if (geometryPath != nullptr)
             glAttachShader(ID, geometry);
+        programCache.prepare(ID);
         glLinkProgram(ID);
+        // nothing above waits for the driver, the status queries in Finish() do
+        if (wait)
+            Finish();
+    }
+    // waits for the program to compile and link, reports errors and makes the shader ready to use
+    // ------------------------------------------------------------------------
+    void Finish()
+    {
+        if (finished)
+            return;
+        for (unsigned int i = 0; i < pendingShaders.size(); i++)
+            checkCompileErrors(pendingShaders[i].first, pendingShaders[i].second);
         checkCompileErrors(ID, "PROGRAM");
+        GLint linked = GL_FALSE;
+        glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+        if (linked)
+            ProgramCache::instance().store(ID, programKey);
+        // resolve the location of every active uniform once, so the setters don't query the driver
+        loadActiveUniforms();
         // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (geometryPath != nullptr)
-            glDeleteShader(geometry);
-
+        for (unsigned int i = 0; i < pendingShaders.size(); i++)
+            glDeleteShader(pendingShaders[i].first);
+        pendingShaders.clear();
+        finished = true;
+    }
+    // reads a shader file into code, replacing each #include "file" line with that file, found relative to the file
+    // that includes it, and adding a #define after the #version line for each of the defines. a file is included only
+    // once, and included files have no #version line of their own. #line directives keep the line numbers of compile
+    // errors right, the source string number in them is the order in which the files were first read
+    // ------------------------------------------------------------------------
+    static bool preprocess(const std::string &path, const std::vector<std::string> &defines, std::string &code)
+    {
+        std::vector<std::string> files;
+        std::ostringstream stream;
+        bool success = includeFile(path, defines, files, stream);
+        code = stream.str();
+        return success;
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -105,61 +130,117 @@ public:
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
+    // returns the location of an active uniform, or -1 if the program doesn't use it.
+    // store the result and use the location overloads below in hot loops to skip the name lookup
+    GLint getUniformLocation(const std::string &name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator it = uniformLocations.find(name);
+        return it != uniformLocations.end() ? it->second : -1;
+    }
+    // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        setBool(getUniformLocation(name), value);
+    }
+    void setBool(GLint location, bool value) const
+    {
+        glUniform1i(location, (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        setInt(getUniformLocation(name), value);
+    }
+    void setInt(GLint location, int value) const
+    {
+        glUniform1i(location, value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        setFloat(getUniformLocation(name), value);
+    }
+    void setFloat(GLint location, float value) const
+    {
+        glUniform1f(location, value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec2(getUniformLocation(name), value);
     }
     void setVec2(const std::string &name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        setVec2(getUniformLocation(name), x, y);
+    }
+    void setVec2(GLint location, const glm::vec2 &value) const
+    {
+        glUniform2fv(location, 1, &value[0]);
+    }
+    void setVec2(GLint location, float x, float y) const
+    {
+        glUniform2f(location, x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec3(getUniformLocation(name), value);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        setVec3(getUniformLocation(name), x, y, z);
+    }
+    void setVec3(GLint location, const glm::vec3 &value) const
+    {
+        glUniform3fv(location, 1, &value[0]);
+    }
+    void setVec3(GLint location, float x, float y, float z) const
+    {
+        glUniform3f(location, x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec4(getUniformLocation(name), value);
+    }
+    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    {
+        setVec4(getUniformLocation(name), x, y, z, w);
+    }
+    void setVec4(GLint location, const glm::vec4 &value) const
+    {
+        glUniform4fv(location, 1, &value[0]);
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w)
+    void setVec4(GLint location, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(location, x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat2(getUniformLocation(name), mat);
+    }
+    void setMat2(GLint location, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat3(getUniformLocation(name), mat);
+    }
+    void setMat3(GLint location, const glm::mat3 &mat) const
+    {
+        glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(getUniformLocation(name), mat);
+    }
+    void setMat4(GLint location, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
     }
 
     // utility function for checking shader compilation/linking errors.
@@ -187,5 +268,152 @@ public:
             }
         }
     }
+
+private:
+    // uniform name -> location, filled after linking
+    std::unordered_map<std::string, GLint> uniformLocations;
+    // stages compiled but not checked yet, with the type checkCompileErrors reports
+    std::vector<std::pair<GLuint, const char*> > pendingShaders;
+    std::string programKey;
+    bool finished;
+
+    // writes a file and the files it includes to the stream, the defines go after the #version of the first file
+    // ------------------------------------------------------------------------
+    static bool includeFile(const std::string &path, const std::vector<std::string> &defines, std::vector<std::string> &files, std::ostringstream &stream)
+    {
+        std::ifstream file(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+            return false;
+        }
+        bool first = files.empty();
+        int fileNumber = (int)files.size();
+        files.push_back(path);
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+        bool success = true;
+        bool definesAdded = !first;
+        bool inComment = false;
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+        {
+            // lines that are only comments, like a header in a block comment, come before #version unchanged
+            if (commentOnly(line, inComment))
+            {
+                stream << line << "\n";
+                continue;
+            }
+            std::string::size_type start = line.find_first_not_of(" \t");
+            bool directive = start != std::string::npos && line[start] == '#';
+            if (directive && line.compare(start, 8, "#version") == 0)
+            {
+                stream << line << "\n";
+                for (unsigned int i = 0; i < defines.size(); i++)
+                    stream << "#define " << defines[i] << "\n";
+                stream << "#line " << lineNumber + 1 << " " << fileNumber << "\n";
+                definesAdded = true;
+                continue;
+            }
+            // a file without #version gets the defines before its first line of code
+            if (!definesAdded && start != std::string::npos)
+            {
+                for (unsigned int i = 0; i < defines.size(); i++)
+                    stream << "#define " << defines[i] << "\n";
+                stream << "#line " << lineNumber << " " << fileNumber << "\n";
+                definesAdded = true;
+            }
+            if (directive && line.compare(start, 8, "#include") == 0)
+            {
+                std::string::size_type open = line.find('"', start), close = line.rfind('"');
+                if (open == std::string::npos || close == open)
+                {
+                    std::cout << "ERROR::SHADER::INVALID_INCLUDE in " << path << "(" << lineNumber << "): " << line << std::endl;
+                    success = false;
+                    continue;
+                }
+                std::string includePath = directory + line.substr(open + 1, close - open - 1);
+                if (std::find(files.begin(), files.end(), includePath) == files.end())
+                {
+                    stream << "#line 1 " << files.size() << "\n";
+                    success = includeFile(includePath, defines, files, stream) && success;
+                }
+                stream << "#line " << lineNumber + 1 << " " << fileNumber << "\n";
+                continue;
+            }
+            stream << line << "\n";
+        }
+        return success;
+    }
+
+    // true when the line has nothing but whitespace and comments. inComment carries an open block comment to the next line
+    static bool commentOnly(const std::string &line, bool &inComment)
+    {
+        bool code = false;
+        for (std::string::size_type i = 0; i < line.size(); i++)
+        {
+            if (inComment)
+            {
+                if (line.compare(i, 2, "*/") == 0)
+                {
+                    inComment = false;
+                    i++;
+                }
+            }
+            else if (line.compare(i, 2, "/*") == 0)
+            {
+                inComment = true;
+                i++;
+            }
+            else if (line.compare(i, 2, "//") == 0)
+                break;
+            else if (line[i] != ' ' && line[i] != '\t' && line[i] != '\r')
+                code = true;
+        }
+        return !code;
+    }
+
+    // queries all the active uniforms of the program and stores their locations.
+    // arrays are registered both by their base name and by each of their elements
+    // ------------------------------------------------------------------------
+    void loadActiveUniforms()
+    {
+        uniformLocations.clear();
+
+        GLint maxNameLength = 0, uniformCount = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &uniformCount);
+        if (maxNameLength <= 0)
+            return;
+
+        std::vector<GLchar> nameBuffer(maxNameLength);
+        for (GLint i = 0; i < uniformCount; ++i)
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, maxNameLength, nullptr, &size, &type, &nameBuffer[0]);
+
+            std::string name(&nameBuffer[0]);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            // uniforms inside uniform blocks don't have a location
+            if (location == -1)
+                continue;
+
+            uniformLocations[name] = location;
+
+            // array uniforms are reported as "name[0]", resolve the remaining elements as well
+            std::string::size_type bracket = name.rfind("[0]");
+            if (bracket != std::string::npos && bracket + 3 == name.size())
+            {
+                std::string baseName = name.substr(0, bracket);
+                uniformLocations[baseName] = location;
+                for (GLint element = 1; element < size; ++element)
+                {
+                    std::string elementName = baseName + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+                }
+            }
+        }
+    }
 };
 #endif
\ No newline at end of file
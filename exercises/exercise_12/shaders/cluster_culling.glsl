@@ -0,0 +1,93 @@
+#version 430 core
+
+layout(local_size_x = 64) in;
+
+struct InstanceData
+{
+   mat4 model;
+   vec4 color;
+};
+
+struct ClusterData
+{
+   vec4 boundingSphere;
+   vec4 normalCone;
+};
+
+struct DrawCommand
+{
+   uint count;
+   uint instanceCount;
+   uint firstIndex;
+   int  baseVertex;
+   uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer sourceInstanceData
+{
+   InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer clusterData
+{
+   ClusterData clusters[];
+};
+
+layout(std430, binding = 2) buffer drawCommands
+{
+   DrawCommand commands[];
+};
+
+layout(std430, binding = 3) writeonly buffer visibleInstanceData
+{
+   uint visibleInstances[];
+};
+
+uniform vec3 frustumPlanes[12];
+uniform vec3 cameraPosition;
+uniform float instanceRadius;
+uniform uint clusterCount;
+uniform uint instanceCount;
+uniform uint maxInstances;
+
+bool isSphereVisible(vec3 center, float radius)
+{
+   for(int i = 0; i < 6; ++i)
+   {
+      vec3 planePoint = frustumPlanes[i * 2];
+      vec3 planeNormal = frustumPlanes[i * 2 + 1];
+      if (dot(center - planePoint, planeNormal) <= -radius)
+         return false;
+   }
+   return true;
+}
+
+void main()
+{
+   uint cluster = gl_GlobalInvocationID.x;
+   uint instance = gl_GlobalInvocationID.y;
+   if (cluster >= clusterCount || instance >= instanceCount)
+      return;
+
+   // the whole instance first, all its clusters share the result
+   mat4 model = instances[instance].model;
+   if (!isSphereVisible(model[3].xyz, instanceRadius))
+      return;
+
+   // bounding sphere of the cluster in world space, scaled by the largest axis of the model matrix
+   float scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+   vec3 center = (model * vec4(clusters[cluster].boundingSphere.xyz, 1.0)).xyz;
+   float radius = clusters[cluster].boundingSphere.w * scale;
+   if (!isSphereVisible(center, radius))
+      return;
+
+   // backface culling of the whole cluster: the camera is inside the cone behind all the triangles
+   vec4 cone = clusters[cluster].normalCone;
+   vec3 axis = normalize(mat3(model) * cone.xyz);
+   vec3 toCluster = center - cameraPosition;
+   if (dot(toCluster, axis) >= cone.w * length(toCluster) + radius)
+      return;
+
+   uint slot = atomicAdd(commands[cluster].instanceCount, 1);
+   visibleInstances[cluster * maxInstances + slot] = instance;
+}
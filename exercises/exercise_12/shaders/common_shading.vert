@@ -3,11 +3,13 @@ layout (location = 0) in vec3 vertex;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 textCoord;
 layout (location = 3) in vec3 tangent;
+layout (location = 5) in uint instanceIndex; // set by the cluster culling draws, 4 is the unused bitangent
 
 uniform mat4 model; // represents model coordinates in the world coord space
 uniform mat4 viewProjection;  // represents the view and projection matrices combined
 
 uniform vec4 reflectionColor;
+uniform bool clusterInstances; // read the instance from instanceIndex instead of gl_InstanceID
 
 
 out vec4 worldPos;
@@ -39,8 +41,9 @@ void main() {
    // if there is a buffer, use it to find the model matrix and the color for this instance
    if (instances.length() > 0)
    {
-      worldPos = instances[gl_InstanceID].model * vec4(vertex, 1.0);
-      vertexColor = instances[gl_InstanceID].color;
+      uint instance = clusterInstances ? instanceIndex : uint(gl_InstanceID);
+      worldPos = instances[instance].model * vec4(vertex, 1.0);
+      vertexColor = instances[instance].color;
    }
 
    // normal in world space (for lighting computation)
@@ -0,0 +1,48 @@
+// point lights binned into clusters of the view frustum, see light_clusters.h
+
+// position and radius, then radiance, for every light
+uniform samplerBuffer ClusterLightData;
+// first index and count of every cluster
+uniform usamplerBuffer ClusterRanges;
+// light indices of all the clusters
+uniform usamplerBuffer ClusterLightIndices;
+
+uniform ivec3 clusterCount; // tiles in x and y, slices in z
+uniform vec2 clusterScreenSize;
+uniform vec2 clusterDepthScaleBias; // slice = log(depth) * scale + bias
+
+// first index and count of the lights of the cluster this fragment is in
+uvec2 GetClusterLightRange()
+{
+   // with a perspective projection, w in clip space is the view depth, and gl_FragCoord.w is 1 / w
+   float depth = 1.0f / gl_FragCoord.w;
+
+   ivec3 cluster;
+   cluster.xy = ivec2(gl_FragCoord.xy / clusterScreenSize * vec2(clusterCount.xy));
+   cluster.z = int(log(depth) * clusterDepthScaleBias.x + clusterDepthScaleBias.y);
+   cluster = clamp(cluster, ivec3(0), clusterCount - 1);
+
+   int index = (cluster.z * clusterCount.y + cluster.y) * clusterCount.x + cluster.x;
+   return texelFetch(ClusterRanges, index).xy;
+}
+
+// the i-th light of a range
+void GetClusterLight(uint i, out vec3 position, out float radius, out vec3 radiance)
+{
+   int light = int(texelFetch(ClusterLightIndices, int(i)).r);
+   vec4 positionRadius = texelFetch(ClusterLightData, light * 2);
+   position = positionRadius.xyz;
+   radius = positionRadius.w;
+   radiance = texelFetch(ClusterLightData, light * 2 + 1).rgb;
+}
+
+// same falloff as the light uniforms
+float GetClusterLightAttenuation(vec3 P, vec3 position, float radius)
+{
+   float distToLight = distance(position, P);
+   float attenuation = 1.0f / (distToLight * distToLight);
+
+   float falloff = smoothstep(radius, radius*0.5f, distToLight);
+
+   return attenuation * falloff;
+}
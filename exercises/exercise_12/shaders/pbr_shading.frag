@@ -101,7 +101,8 @@ vec3 GetNormalMap()
    // Unpack from range [0, 1] to [-1 , 1]
    normalMap = normalMap * 2.0 - 1.0;
 
-   // This time we are storing Z component in the texture, no need to compute it. Instead we normalize just in case
+   // BC5 compressed normal maps only store X and Y, so Z is computed knowing that the normal length is 1
+   normalMap.z = sqrt(max(1.0 - dot(normalMap.xy, normalMap.xy), 0.0));
    normalMap = normalize(normalMap);
 
    // Create tangent space matrix
@@ -164,6 +165,32 @@ float GetAttenuation(vec4 P)
    return attenuation * falloff;
 }
 
+#ifdef CLUSTERED_LIGHTS
+#include "light_clusters.glsl"
+
+// direct lighting of the point lights in the cluster of this fragment, added in the same pass as the first light
+vec3 GetClusteredLighting(vec3 P, vec3 N, vec3 V, vec3 albedo, vec3 F0)
+{
+   vec3 lighting = vec3(0.0f);
+   uvec2 range = GetClusterLightRange();
+   for (uint i = range.x; i < range.x + range.y; i++)
+   {
+      vec3 position, radiance;
+      float radius;
+      GetClusterLight(i, position, radius, radiance);
+
+      vec3 L = normalize(position - P);
+      vec3 diffuse = mix(GetLambertianDiffuseLighting(N, L, albedo), vec3(0), metalness);
+      vec3 specular = GetCookTorranceSpecularLighting(N, L, V);
+      vec3 F = FresnelSchlick(F0, max(dot(normalize(L + V), V), 0.0));
+
+      radiance *= GetClusterLightAttenuation(P, position, radius) * max(dot(N, L), 0.0);
+      lighting += mix(diffuse, specular, F) * radiance;
+   }
+   return lighting;
+}
+#endif
+
 void main()
 {
    vec4 P = worldPos;
@@ -215,5 +242,9 @@ void main()
    // lighting = indirect lighting (ambient + environment) + direct lighting (diffuse + specular)
    vec3 lighting = indirectLight + directLight;
 
+#ifdef CLUSTERED_LIGHTS
+   lighting += GetClusteredLighting(P.xyz, N, V, albedo, F0);
+#endif
+
    FragColor = vec4(lighting, 1.0f);
 }
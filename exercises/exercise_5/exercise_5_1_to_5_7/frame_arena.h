@@ -0,0 +1,213 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+// a linear allocator for data that only lives during a frame. allocations bump an offset through a block of memory and
+// are never freed one by one: reset() at the end of the frame makes all of it available again.
+// when a frame needs more than the block holds, more blocks come from the heap, and the next reset merges them into one
+// block big enough for that frame, so in steady state frames don't touch the heap at all
+class FrameArena
+{
+public:
+    static FrameArena& instance()
+    {
+        static FrameArena arena;
+        return arena;
+    }
+
+    ~FrameArena()
+    {
+        for (unsigned int i = 0; i < blocks.size(); i++)
+            std::free(blocks[i].memory);
+    }
+
+    // alignment has to be a power of two, at most the alignment malloc guarantees
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        allocations++;
+        bytesAllocated += bytes;
+        if (current < blocks.size())
+        {
+            size_t start = (offset + alignment - 1) & ~(alignment - 1);
+            if (start + bytes <= blocks[current].size)
+            {
+                offset = start + bytes;
+                return blocks[current].memory + start;
+            }
+            current++;
+        }
+
+        // continue in the next block that is big enough, or in a new one
+        while (current < blocks.size() && blocks[current].size < bytes)
+            current++;
+        if (current == blocks.size())
+            blocks.push_back(newBlock(bytes > BLOCK_SIZE ? bytes : BLOCK_SIZE));
+        offset = bytes;
+        return blocks[current].memory;
+    }
+
+    // a position in the arena, rewinding to it frees everything allocated after it
+    struct Marker
+    {
+        size_t block, offset;
+    };
+
+    Marker mark() const
+    {
+        Marker marker = { current, offset };
+        return marker;
+    }
+
+    // markers don't survive a reset
+    void rewind(Marker marker)
+    {
+        current = marker.block;
+        offset = marker.offset;
+    }
+
+    // call once at the end of every frame, when nothing allocated in it is used any more
+    void reset()
+    {
+        // a frame that needed several blocks gets one of their combined size. the merged block is counted in the frame
+        // that needed it, not in the next one
+        if (blocks.size() > 1)
+        {
+            size_t size = 0;
+            for (unsigned int i = 0; i < blocks.size(); i++)
+            {
+                size += blocks[i].size;
+                std::free(blocks[i].memory);
+            }
+            blocks.clear();
+            blocks.push_back(newBlock(size));
+        }
+
+        lastAllocations = allocations;
+        lastHeapAllocations = heapAllocations;
+        lastBytes = bytesAllocated;
+        allocations = heapAllocations = 0;
+        bytesAllocated = 0;
+
+        current = 0;
+        offset = 0;
+    }
+
+    // gives the blocks back to the heap, if nothing is allocated in the arena
+    void release()
+    {
+        if (current != 0 || offset != 0)
+            return;
+        for (unsigned int i = 0; i < blocks.size(); i++)
+            std::free(blocks[i].memory);
+        blocks.clear();
+    }
+
+    // debug counters of the last frame: allocations made in the arena, blocks it took from the heap, and bytes handed out
+    unsigned int allocationsLastFrame() const { return lastAllocations; }
+    unsigned int heapAllocationsLastFrame() const { return lastHeapAllocations; }
+    size_t bytesLastFrame() const { return lastBytes; }
+
+    size_t capacity() const
+    {
+        size_t size = 0;
+        for (unsigned int i = 0; i < blocks.size(); i++)
+            size += blocks[i].size;
+        return size;
+    }
+
+    // the arena is a process-wide singleton
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+private:
+    FrameArena() : current(0), offset(0), allocations(0), heapAllocations(0), bytesAllocated(0),
+                   lastAllocations(0), lastHeapAllocations(0), lastBytes(0)
+    {
+    }
+
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Block
+    {
+        unsigned char *memory;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current, offset; // block in use, and the first free byte in it
+    unsigned int allocations, heapAllocations;
+    size_t bytesAllocated;
+    unsigned int lastAllocations, lastHeapAllocations;
+    size_t lastBytes;
+
+    Block newBlock(size_t size)
+    {
+        Block block;
+        block.memory = (unsigned char*)std::malloc(size);
+        if (!block.memory)
+            throw std::bad_alloc();
+        block.size = size;
+        heapAllocations++;
+        return block;
+    }
+};
+
+// frees what was allocated in the arena during its lifetime, for temporary data outside of the frame loop.
+// declare it before the containers that use the arena, so they are destroyed first.
+// with releaseBlocks, a scope that leaves the arena empty also gives its blocks back to the heap, so a one-off peak like
+// loading a file isn't kept for the rest of the program
+class FrameArenaScope
+{
+public:
+    explicit FrameArenaScope(bool releaseBlocks = false) : marker(FrameArena::instance().mark()), releaseBlocks(releaseBlocks) {}
+    ~FrameArenaScope()
+    {
+        FrameArena &arena = FrameArena::instance();
+        arena.rewind(marker);
+        if (releaseBlocks)
+            arena.release();
+    }
+
+    FrameArenaScope(const FrameArenaScope&) = delete;
+    FrameArenaScope& operator=(const FrameArenaScope&) = delete;
+
+private:
+    FrameArena::Marker marker;
+    bool releaseBlocks;
+};
+
+// lets the standard containers allocate in the frame arena. deallocation does nothing, the memory comes back when the
+// arena is reset, so containers that use it must not outlive the frame
+template <class T>
+class FrameAllocator
+{
+public:
+    typedef T value_type;
+
+    FrameAllocator() {}
+    template <class U>
+    FrameAllocator(const FrameAllocator<U>&) {}
+
+    T* allocate(size_t count)
+    {
+        return (T*)FrameArena::instance().allocate(count * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T*, size_t) {}
+};
+
+template <class T, class U>
+bool operator==(const FrameAllocator<T>&, const FrameAllocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const FrameAllocator<T>&, const FrameAllocator<U>&) { return false; }
+
+template <class T>
+using FrameVector = std::vector<T, FrameAllocator<T> >;
+typedef std::basic_string<char, std::char_traits<char>, FrameAllocator<char> > FrameString;
+#endif
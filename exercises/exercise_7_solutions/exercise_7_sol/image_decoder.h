@@ -0,0 +1,86 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// pixels of an image file decoded in memory, ready to be uploaded to a texture
+struct DecodedImage
+{
+    DecodedImage() : width(0), height(0), components(0), data(nullptr) {}
+
+    std::string path;
+    int width, height, components;
+    unsigned char *data; // nullptr if the file could not be decoded
+
+    void free()
+    {
+        if (data)
+            stbi_image_free(data);
+        data = nullptr;
+    }
+};
+
+// decodes batches of image files on a pool of worker threads.
+// decoding doesn't touch OpenGL, so only the upload of the results has to stay on the thread that owns the context
+class ImageDecoder
+{
+public:
+    // decodes all the files in parallel and returns them in the same order as the paths.
+    // the caller owns the pixel data and must free() every image once it has been uploaded
+    static std::vector<DecodedImage> decode(const std::vector<std::string> &paths, int desiredComponents = 0)
+    {
+        std::vector<DecodedImage> images(paths.size());
+        parallelFor(paths.size(), [&images, &paths, desiredComponents](size_t i)
+        {
+            images[i] = decodeFile(paths[i], desiredComponents);
+        });
+        return images;
+    }
+
+    // decodes a single file on the calling thread
+    static DecodedImage decodeFile(const std::string &path, int desiredComponents = 0)
+    {
+        DecodedImage image;
+        image.path = path;
+        image.data = stbi_load(path.c_str(), &image.width, &image.height, &image.components, desiredComponents);
+        if (image.data && desiredComponents != 0)
+            image.components = desiredComponents;
+        return image;
+    }
+
+    // runs job(0) ... job(count - 1) on the pool and waits until all of them are done
+    static void parallelFor(size_t count, const std::function<void(size_t)> &job)
+    {
+        // every worker keeps taking the next index that nobody has started yet
+        std::atomic<size_t> next(0);
+        auto worker = [&job, &next, count]()
+        {
+            for (size_t i = next++; i < count; i = next++)
+                job(i);
+        };
+
+        // the calling thread works as one of the workers
+        size_t threadCount = std::min<size_t>(threadPoolSize(), count);
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < threadCount; i++)
+            threads.emplace_back(worker);
+        worker();
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+    }
+
+    // number of threads used to decode a batch
+    static unsigned int threadPoolSize()
+    {
+        unsigned int count = std::thread::hardware_concurrency();
+        return count > 0 ? count : 4;
+    }
+};
+#endif
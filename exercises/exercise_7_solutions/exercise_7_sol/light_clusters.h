@@ -0,0 +1,232 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <render_state.h>
+#include <shader.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// the point lights of a forward renderer binned into clusters, the cells of a grid that splits the view frustum in tiles
+// on the screen and in slices along the depth. the slices get thicker with the distance, so clusters stay about as deep
+// as they are wide. a fragment only evaluates the lights of its cluster, so the scene is drawn once for all the lights
+// instead of once per light.
+// the grid is built on the CPU every frame and read by shaders/light_clusters.glsl from buffer textures, which GL 3.3 has
+class LightClusters
+{
+public:
+    LightClusters(unsigned int tilesX = 16, unsigned int tilesY = 9, unsigned int slices = 24)
+        : tilesX(tilesX), tilesY(tilesY), slices(slices), nearPlane(0.1f), farPlane(100.0f), depthScale(1.0f), depthBias(0.0f)
+    {
+        glGenBuffers(BUFFER_COUNT, buffers);
+        glGenTextures(BUFFER_COUNT, textures);
+        const GLenum formats[BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        for (unsigned int i = 0; i < BUFFER_COUNT; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~LightClusters()
+    {
+        glDeleteTextures(BUFFER_COUNT, textures);
+        glDeleteBuffers(BUFFER_COUNT, buffers);
+    }
+
+    // the clusters own GL objects, so they can't be copied
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // the lights are gathered again every frame
+    void Clear()
+    {
+        lightData.clear();
+    }
+
+    // position in world space, and radiance as the light color times its intensity
+    void AddLight(const glm::vec3 &position, float radius, const glm::vec3 &radiance)
+    {
+        lightData.push_back(glm::vec4(position, radius));
+        lightData.push_back(glm::vec4(radiance, 0.0f));
+    }
+
+    // bins the lights into the clusters of the camera, and uploads the lists
+    void Build(const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane)
+    {
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        // slice = log(depth / near) / log(far / near) * slices, written as log(depth) * scale + bias for the shader
+        depthScale = slices / std::log(farPlane / nearPlane);
+        depthBias = -std::log(nearPlane) * depthScale;
+
+        // 1. the clusters every light touches, and how many lights each cluster gets
+        // this stays scalar: the counting scatters into clusters that neighbouring lights share, and even at 4096 lights
+        // the bounds are a few hundred flops each, small next to drawing the scene
+        ranges.assign(ClusterCount() * 2, 0);
+        lightBounds.clear();
+        for (unsigned int light = 0; light < LightCount(); light++)
+        {
+            Bounds bounds;
+            if (!findBounds(lightData[light * 2], view, projection, bounds))
+                continue;
+            bounds.light = light;
+            lightBounds.push_back(bounds);
+            for (int z = bounds.min.z; z <= bounds.max.z; z++)
+                for (int y = bounds.min.y; y <= bounds.max.y; y++)
+                    for (int x = bounds.min.x; x <= bounds.max.x; x++)
+                        ranges[clusterIndex(x, y, z) * 2 + 1]++;
+        }
+
+        // 2. the lights of a cluster follow the ones of the clusters before it
+        GLuint first = 0;
+        for (unsigned int cluster = 0; cluster < ClusterCount(); cluster++)
+        {
+            ranges[cluster * 2] = first;
+            first += ranges[cluster * 2 + 1];
+            ranges[cluster * 2 + 1] = 0;
+        }
+
+        // 3. the index of every light in each of its clusters, counting again
+        indices.resize(std::max(first, 1u));
+        for (unsigned int i = 0; i < lightBounds.size(); i++)
+        {
+            const Bounds &bounds = lightBounds[i];
+            for (int z = bounds.min.z; z <= bounds.max.z; z++)
+                for (int y = bounds.min.y; y <= bounds.max.y; y++)
+                    for (int x = bounds.min.x; x <= bounds.max.x; x++)
+                    {
+                        unsigned int cluster = clusterIndex(x, y, z);
+                        indices[ranges[cluster * 2] + ranges[cluster * 2 + 1]++] = bounds.light;
+                    }
+        }
+        indexCount = first;
+
+        if (lightData.empty())
+            lightData.push_back(glm::vec4(0.0f));
+        upload(LIGHT_DATA, &lightData[0], lightData.size() * sizeof(glm::vec4));
+        upload(RANGES, &ranges[0], ranges.size() * sizeof(GLuint));
+        upload(INDICES, &indices[0], indices.size() * sizeof(GLuint));
+    }
+
+    // binds the lists to three texture units from firstUnit on, and sets the uniforms light_clusters.glsl reads
+    void Bind(Shader &shader, GLuint firstUnit)
+    {
+        const char *samplers[BUFFER_COUNT] = { "ClusterLightData", "ClusterRanges", "ClusterLightIndices" };
+        RenderState &renderState = RenderState::instance();
+        for (unsigned int i = 0; i < BUFFER_COUNT; i++)
+        {
+            renderState.bindTexture(firstUnit + i, GL_TEXTURE_BUFFER, textures[i]);
+            shader.setInt(samplers[i], firstUnit + i);
+        }
+        renderState.activeTexture(0);
+
+        // the tiles split the viewport the scene is drawn to
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glUniform3i(shader.getUniformLocation("clusterCount"), tilesX, tilesY, slices);
+        shader.setVec2("clusterScreenSize", (float)viewport[2], (float)viewport[3]);
+        shader.setVec2("clusterDepthScaleBias", depthScale, depthBias);
+    }
+
+    unsigned int LightCount() const
+    {
+        return (unsigned int)lightData.size() / 2;
+    }
+
+    unsigned int ClusterCount() const
+    {
+        return tilesX * tilesY * slices;
+    }
+
+    // light indices in all the clusters of the last Build, each light is counted in every cluster it touches
+    unsigned int IndexCount() const
+    {
+        return indexCount;
+    }
+
+private:
+    enum Buffer { LIGHT_DATA, RANGES, INDICES, BUFFER_COUNT };
+
+    // the clusters a light touches, inclusive
+    struct Bounds
+    {
+        glm::ivec3 min, max;
+        unsigned int light;
+    };
+
+    unsigned int tilesX, tilesY, slices;
+    float nearPlane, farPlane, depthScale, depthBias;
+    GLuint buffers[BUFFER_COUNT], textures[BUFFER_COUNT];
+    unsigned int indexCount = 0;
+
+    std::vector<glm::vec4> lightData;  // position and radius, then radiance, for every light
+    std::vector<GLuint> ranges;        // first index and count of every cluster
+    std::vector<GLuint> indices;       // light indices of all the clusters, one cluster after the other
+    std::vector<Bounds> lightBounds;
+
+    unsigned int clusterIndex(int x, int y, int z) const
+    {
+        return ((unsigned int)z * tilesY + (unsigned int)y) * tilesX + (unsigned int)x;
+    }
+
+    // the clusters touched by the box around the light's sphere, false if it is outside of the view frustum
+    bool findBounds(const glm::vec4 &positionRadius, const glm::mat4 &view, const glm::mat4 &projection, Bounds &bounds) const
+    {
+        glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(positionRadius), 1.0f));
+        float radius = positionRadius.w;
+        float nearDepth = -center.z - radius;
+        float farDepth = -center.z + radius;
+        if (farDepth < nearPlane || nearDepth > farPlane)
+            return false;
+        // the part of the sphere in front of the near plane is never seen
+        nearDepth = std::max(nearDepth, nearPlane);
+
+        // the projection of the box is bounded by its corners
+        glm::vec2 ndcMin(FLT_MAX), ndcMax(-FLT_MAX);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec4 viewCorner(center.x + (corner & 1 ? radius : -radius), center.y + (corner & 2 ? radius : -radius), corner & 4 ? -farDepth : -nearDepth, 1.0f);
+            glm::vec4 clipCorner = projection * viewCorner;
+            glm::vec2 ndcCorner = glm::vec2(clipCorner.x, clipCorner.y) / clipCorner.w;
+            ndcMin = glm::min(ndcMin, ndcCorner);
+            ndcMax = glm::max(ndcMax, ndcCorner);
+        }
+        if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+            return false;
+
+        bounds.min = glm::ivec3(tile(ndcMin.x, tilesX), tile(ndcMin.y, tilesY), slice(nearDepth));
+        bounds.max = glm::ivec3(tile(ndcMax.x, tilesX), tile(ndcMax.y, tilesY), slice(std::min(farDepth, farPlane)));
+        return true;
+    }
+
+    static int tile(float ndc, unsigned int tiles)
+    {
+        int index = (int)std::floor((ndc * 0.5f + 0.5f) * tiles);
+        return std::min(std::max(index, 0), (int)tiles - 1);
+    }
+
+    int slice(float depth) const
+    {
+        int index = (int)std::floor(std::log(depth) * depthScale + depthBias);
+        return std::min(std::max(index, 0), (int)slices - 1);
+    }
+
+    void upload(Buffer buffer, const void *data, size_t bytes)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+        glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+#endif
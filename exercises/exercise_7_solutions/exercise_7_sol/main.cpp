@@ -2,6 +2,7 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 
+#include <random>
 #include <vector>
 
 // NEW! as our scene gets more complex, we start using more helper classes
@@ -10,6 +11,7 @@
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "light_clusters.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -32,8 +34,10 @@ const unsigned int SCR_HEIGHT = 720;
 // -----------------------------------
 Shader* shader;
 Shader* forward_shading;
+Shader* forward_shading_clustered; // forward_shading with CLUSTERED_LIGHTS, all the lights in one pass
 Shader* deferred_shading;
 Shader* lighting_shader;
+LightClusters* lightClusters; // point lights binned into clusters of the view frustum
 Model* carBodyModel;
 Model* carPaintModel;
 Model* carInteriorModel;
@@ -132,6 +136,9 @@ struct Config
 
     std::vector<Light> lights;
 
+    // random point lights added to the three above
+    int extraLightCount = 0;
+
 } config;
 
 
@@ -142,6 +149,7 @@ void initGBuffers(GLFWwindow* window);
 void setAmbientUniforms(glm::vec3 ambientLightColor);
 void setLightUniforms(Light &light, Camera* viewSpace = nullptr);
 void setupForwardAdditionalPass();
+void updateExtraLights();
 void resetForwardAdditionalPass();
 void drawCube();
 void drawQuad();
@@ -190,9 +198,11 @@ int main()
     // load the shaders and the 3D models
     // ----------------------------------
     forward_shading = new Shader("shaders/forward_shading.vert", "shaders/forward_shading.frag");
+    forward_shading_clustered = new Shader("shaders/forward_shading.vert", "shaders/forward_shading.frag", nullptr, true, {"CLUSTERED_LIGHTS"});
     deferred_shading = new Shader("shaders/deferred_shading.vert", "shaders/deferred_shading.frag");
     lighting_shader = new Shader("shaders/lighting.vert", "shaders/lighting.frag");
     shader = forward_shading;
+    lightClusters = new LightClusters();
 
     carBodyModel = new Model("car/Body_LOD0.obj");
     carPaintModel = new Model("car/Paint_LOD0.obj");
@@ -238,6 +248,7 @@ int main()
         glm::mat4 viewProjection = projection * view;
 
         processInput(window);
+        updateExtraLights();
 
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -347,16 +358,32 @@ int main()
             // First light + ambient
             setAmbientUniforms(config.ambientLightColor * config.ambientLightIntensity);
             setLightUniforms(config.lights[0]);
-            drawObjects();
-
-            // Additional additive lights
-            setupForwardAdditionalPass();
-            for (int i = 1; i < config.lights.size(); ++i)
+            if (shader == forward_shading_clustered)
+            {
+                // the other lights are added in the same pass, each fragment with the lights of its cluster
+                lightClusters->Clear();
+                for (int i = 1; i < config.lights.size(); ++i)
+                {
+                    const Light &light = config.lights[i];
+                    lightClusters->AddLight(light.position, light.radius, light.color * light.intensity);
+                }
+                lightClusters->Build(view, projection, 0.1f, 100.0f);
+                lightClusters->Bind(*shader, 7);
+                drawObjects();
+            }
+            else
             {
-                setLightUniforms(config.lights[i]);
                 drawObjects();
+
+                // Additional additive lights
+                setupForwardAdditionalPass();
+                for (int i = 1; i < config.lights.size(); ++i)
+                {
+                    setLightUniforms(config.lights[i]);
+                    drawObjects();
+                }
+                resetForwardAdditionalPass();
             }
-            resetForwardAdditionalPass();
         }
 
         if (isPaused) {
@@ -381,6 +408,8 @@ int main()
     delete carWheelModel;
     delete floorModel;
     delete forward_shading;
+    delete forward_shading_clustered;
+    delete lightClusters;
     delete deferred_shading;
     delete lighting_shader;
 
@@ -427,6 +456,9 @@ void drawGui(){
         ImGui::SliderFloat("light 3 radius", &config.lights[2].radius, 0.01f, 50.0f);
         ImGui::Separator();
 
+        ImGui::SliderInt("extra lights", &config.extraLightCount, 0, 4096);
+        ImGui::Separator();
+
 
         ImGui::Text("Material: ");
         ImGui::ColorEdit3("reflection color", (float*)&config.reflectionColor);
@@ -439,8 +471,11 @@ void drawGui(){
         ImGui::Text("Shading model: ");
         {
             if (ImGui::RadioButton("Forward Shading", shader == forward_shading)) { shader = forward_shading; }
+            if (ImGui::RadioButton("Clustered Forward Shading", shader == forward_shading_clustered)) { shader = forward_shading_clustered; }
             if (ImGui::RadioButton("Deferred Shading", shader == deferred_shading)) { shader = deferred_shading; }
         }
+        if (shader == forward_shading_clustered)
+            ImGui::Text("%u light indices in %u clusters", lightClusters->IndexCount(), lightClusters->ClusterCount());
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::End();
     }
@@ -526,6 +561,25 @@ void setLightUniforms(Light& light, Camera* viewSpace)
     shader->setFloat("lightRadius", light.radius);
 }
 
+void updateExtraLights()
+{
+    // the three lights come first, the extra ones are added or removed at the end
+    const size_t lightCount = 3 + (size_t)std::max(config.extraLightCount, 0);
+    if (config.lights.size() > lightCount)
+        config.lights.erase(config.lights.begin() + lightCount, config.lights.end());
+
+    // scattered around the car, each one placed from its index so it stays where it was when the count changes
+    while (config.lights.size() < lightCount)
+    {
+        // braces evaluate the draws left to right, the order of unspecified argument evaluation would differ per compiler
+        std::mt19937 random((unsigned int)config.lights.size());
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        glm::vec3 position{unit(random) * 20.0f - 10.0f, unit(random), unit(random) * 20.0f - 10.0f};
+        glm::vec3 color{0.5f + unit(random) * 0.5f, 0.5f + unit(random) * 0.5f, 0.5f + unit(random) * 0.5f};
+        config.lights.emplace_back(position, color, 0.25f, 1.0f);
+    }
+}
+
 void setupForwardAdditionalPass()
 {
     // Remove ambient from additional passes
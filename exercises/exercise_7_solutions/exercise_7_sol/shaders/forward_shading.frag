@@ -3,11 +3,7 @@
 uniform vec3 camPosition; // so we can compute the view vector
 out vec4 FragColor; // the output color of this fragment
 
-// light uniform variables
-uniform vec3 ambientLightColor;
-uniform vec3 lightPosition;
-uniform vec3 lightColor;
-uniform float lightRadius;
+#include "phong_lighting.glsl"
 
 // material properties
 uniform vec3 reflectionColor;
@@ -27,6 +23,25 @@ in vec3 worldNormal;
 // TODO 7.3 : Add an 'in' variable for texture coordinates
 in vec2 textureCoordinates;
 
+#ifdef CLUSTERED_LIGHTS
+#include "light_clusters.glsl"
+
+// the point lights in the cluster of this fragment, added in the same pass as the first light
+vec3 GetClusteredLighting(vec3 P, vec3 N, vec3 V, vec3 albedo)
+{
+   vec3 lighting = vec3(0.0f);
+   uvec2 range = GetClusterLightRange();
+   for (uint i = range.x; i < range.x + range.y; i++)
+   {
+      vec3 position, radiance;
+      float radius;
+      GetClusterLight(i, position, radius, radiance);
+      lighting += GetPhongDirectLighting(P, N, V, albedo, position, radiance, radius, diffuseReflectance, specularReflectance, specularExponent);
+   }
+   return lighting;
+}
+#endif
+
 void main()
 {
    vec4 P = worldPos;
@@ -37,25 +52,11 @@ void main()
    albedo *= reflectionColor;
 
    // phong shading (i.e. Phong reflection model computed in the fragment shader)
-   vec3 ambient = ambientLightColor * ambientReflectance * albedo;
-
-   vec3 L = normalize(lightPosition - P.xyz);
-   float diffuseModulation = max(dot(N, L), 0.0);
-   vec3 diffuse = lightColor * diffuseReflectance * diffuseModulation * albedo;
-
    vec3 V = normalize(camPosition - P.xyz);
-   vec3 H = normalize(L + V);
-   float specModulation = pow(max(dot(H, N), 0.0), specularExponent);
-   vec3 specular = lightColor * specularReflectance * specModulation;
-
-   float distToLight = distance(lightPosition, P.xyz);
-   float attenuation = 1.0f / (distToLight * distToLight);
-
-   // TODO 7.1 : Compute the falloff using lightRadius and smoothstep function
-   float falloff = smoothstep(lightRadius, lightRadius*0.5f, distToLight);
-
-   // TODO 7.1 : Multiply the attenuation by the falloff we just computed
-   attenuation *= falloff;
+   vec3 lighting = GetPhongLighting(P.xyz, N, V, albedo, ambientReflectance, diffuseReflectance, specularReflectance, specularExponent);
+#ifdef CLUSTERED_LIGHTS
+   lighting += GetClusteredLighting(P.xyz, N, V, albedo);
+#endif
 
-   FragColor = vec4(ambient + (diffuse + specular) * attenuation, 1.0);
+   FragColor = vec4(lighting, 1.0);
 }
@@ -3,11 +3,7 @@
 // transform matrices
 uniform mat4 invProjection; // transform from clip space to view space
 
-// light uniform variables
-uniform vec3 ambientLightColor;
-uniform vec3 lightPosition;
-uniform vec3 lightColor;
-uniform float lightRadius;
+#include "phong_lighting.glsl"
 
 // g-buffers
 uniform sampler2D AlbedoGBuffer;
@@ -65,30 +61,12 @@ void main()
    float specularExponent = others.w * 100.0f;
 
 
-   // TODO 7.6 : Compute the light vector (L) as usual. lightPosition is already in view space
-   vec3 L = normalize(lightPosition - P.xyz);
-
    // TODO 7.6 : Compute the view vector (V) as usual, but taking into account that camera position in view space is (0, 0, 0)
    vec3 V = normalize(-P.xyz);
 
-   // TODO 7.6 : Compute the lighting using the phong reflection model. You can get inspired by forward_shading.frag
+   // TODO 7.6 : Compute the lighting using the phong reflection model, shared with forward_shading.frag. lightPosition is already in view space
    vec3 N = normal;
-
-   vec3 ambient = ambientLightColor * ambientReflectance * albedo;
-
-   float diffuseModulation = max(dot(N, L), 0.0);
-   vec3 diffuse = lightColor * diffuseReflectance * diffuseModulation * albedo;
-
-   vec3 H = normalize(L + V);
-   float specModulation = pow(max(dot(H, N), 0.0), specularExponent);
-   vec3 specular = lightColor * specularReflectance * specModulation;
-
-   float distToLight = distance(lightPosition, P.xyz);
-   float attenuation = 1.0f / (distToLight * distToLight);
-   float falloff = smoothstep(lightRadius, lightRadius*0.5f, distToLight);
-   attenuation *= falloff;
-
-   vec3 lighting = ambient + (diffuse + specular) * attenuation;
+   vec3 lighting = GetPhongLighting(P.xyz, N, V, albedo, ambientReflectance, diffuseReflectance, specularReflectance, specularExponent);
 
    // Debug output for view space position
    //FragColor = P;
@@ -0,0 +1,38 @@
+// phong reflection model, shared by forward_shading.frag and lighting.frag. include it after #version
+
+// light uniform variables
+uniform vec3 ambientLightColor;
+uniform vec3 lightPosition;
+uniform vec3 lightColor;
+uniform float lightRadius;
+
+// diffuse and specular light of one point light, P, N and V in the same space as position
+vec3 GetPhongDirectLighting(vec3 P, vec3 N, vec3 V, vec3 albedo, vec3 position, vec3 color, float radius, float diffuseReflectance, float specularReflectance, float specularExponent)
+{
+   vec3 L = normalize(position - P);
+   float diffuseModulation = max(dot(N, L), 0.0);
+   vec3 diffuse = color * diffuseReflectance * diffuseModulation * albedo;
+
+   vec3 H = normalize(L + V);
+   float specModulation = pow(max(dot(H, N), 0.0), specularExponent);
+   vec3 specular = color * specularReflectance * specModulation;
+
+   float distToLight = distance(position, P);
+   float attenuation = 1.0f / (distToLight * distToLight);
+
+   // TODO 7.1 : Compute the falloff using lightRadius and smoothstep function
+   float falloff = smoothstep(radius, radius*0.5f, distToLight);
+
+   // TODO 7.1 : Multiply the attenuation by the falloff we just computed
+   attenuation *= falloff;
+
+   return (diffuse + specular) * attenuation;
+}
+
+// P, N and V in the same space as lightPosition
+vec3 GetPhongLighting(vec3 P, vec3 N, vec3 V, vec3 albedo, float ambientReflectance, float diffuseReflectance, float specularReflectance, float specularExponent)
+{
+   vec3 ambient = ambientLightColor * ambientReflectance * albedo;
+
+   return ambient + GetPhongDirectLighting(P, N, V, albedo, lightPosition, lightColor, lightRadius, diffuseReflectance, specularReflectance, specularExponent);
+}
@@ -482,33 +482,42 @@ unsigned int initSkyboxBuffers() {
 // -------------------------------------------------------
 unsigned int loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrComponents;
+    // the six faces are converted once into a container with all their mip levels, later runs only map it
+    std::string containerFile = TextureContainer::containerPath(faces[0] + ".cube", true);
+    bool upToDate = true;
     for (unsigned int i = 0; i < faces.size(); i++)
+        upToDate = upToDate && TextureContainer::isUpToDate(containerFile, faces[i]);
+
+    TextureContainer container;
+    if (!upToDate || !container.load(containerFile))
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        // decode the six faces in parallel
+        vector<DecodedImage> images = ImageDecoder::decode(faces, 3);
+        bool complete = true;
+        for (unsigned int i = 0; i < images.size(); i++)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_SRGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            if (!images[i].data)
+            {
+                std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+                complete = false;
+            }
         }
-        else
+        if (complete)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            container = TextureContainer::fromImages(images, true, TextureContainer::defaultCompression(3));
+            container.write(containerFile);
         }
+        for (unsigned int i = 0; i < images.size(); i++)
+            images[i].free();
     }
+
+    unsigned int textureID = container.upload();
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
     return textureID;
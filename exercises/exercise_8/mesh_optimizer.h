@@ -0,0 +1,379 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// reorders indexed triangle lists so the GPU does less work drawing them:
+// - optimizeVertexCache: triangle order that reuses the post-transform vertex cache (Tom Forsyth's linear-speed algorithm)
+// - optimizeOverdraw: moves clusters of triangles facing outwards to the front, so they occlude the rest from most views
+// - optimizeVertexFetch: vertex order that follows the index buffer, so vertex fetches walk memory linearly
+// run them in that order, the overdraw pass keeps the cache order inside each cluster.
+// buildClusters then splits the final index buffer into small clusters with the data needed to cull them
+
+// a range of neighbouring triangles in the index buffer, culled as a whole
+struct MeshCluster
+{
+    glm::vec4 boundingSphere; // center and radius, in model space
+    // axis and cutoff of the normal cone: every triangle faces away from a camera at position p when
+    // dot(center - p, axis) >= cutoff * length(center - p) + radius. a cutoff of 1 means the cone can't be culled
+    glm::vec4 normalCone;
+    unsigned int firstIndex;
+    unsigned int indexCount;
+};
+
+class MeshOptimizer
+{
+public:
+    // vertex cache efficiency of an index buffer, simulating a FIFO post-transform cache
+    struct CacheStats
+    {
+        unsigned int triangles;
+        unsigned int vertices;
+        unsigned int transforms; // vertex shader invocations, i.e. cache misses
+        float acmr;              // average cache miss ratio: transforms per triangle, 0.5 at best and 3 at worst
+        float atvr;              // average transform to vertex ratio: transforms per vertex, 1 at best
+    };
+
+    static CacheStats analyzeVertexCache(const std::vector<unsigned int> &indices, unsigned int vertexCount, unsigned int cacheSize = 16)
+    {
+        CacheStats stats;
+        stats.triangles = (unsigned int)indices.size() / 3;
+        stats.vertices = vertexCount;
+        stats.transforms = 0;
+
+        // cache entries record the transform that loaded the vertex, entries older than cacheSize transforms are gone
+        std::vector<unsigned int> loadedAt(vertexCount, 0);
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            unsigned int &loaded = loadedAt[indices[i]];
+            if (loaded == 0 || stats.transforms - loaded >= cacheSize)
+                loaded = ++stats.transforms;
+        }
+
+        stats.acmr = stats.triangles > 0 ? (float)stats.transforms / stats.triangles : 0.0f;
+        stats.atvr = vertexCount > 0 ? (float)stats.transforms / vertexCount : 0.0f;
+        return stats;
+    }
+
+    // greedily emits the triangle with the best score, where vertices score higher the more recently they were used
+    // and the fewer triangles they have left, so that vertices are finished while they are still in the cache
+    static void optimizeVertexCache(std::vector<unsigned int> &indices, unsigned int vertexCount)
+    {
+        const int cacheSize = 32;
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        // triangles using each vertex
+        std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacencyOffset[indices[i] + 1]++;
+        for (unsigned int v = 0; v < vertexCount; v++)
+            adjacencyOffset[v + 1] += adjacencyOffset[v];
+        std::vector<unsigned int> adjacency(indices.size());
+        std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+        std::vector<unsigned int> remaining(vertexCount);
+        for (unsigned int v = 0; v < vertexCount; v++)
+            remaining[v] = adjacencyOffset[v + 1] - adjacencyOffset[v];
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for (unsigned int v = 0; v < vertexCount; v++)
+            vertexScore[v] = forsythScore(-1, remaining[v], cacheSize);
+
+        std::vector<float> triangleScore(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+            triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        std::vector<unsigned int> cache, nextCache;
+        size_t scanCursor = 0;
+
+        int bestTriangle = 0;
+        for (size_t t = 1; t < triangleCount; t++)
+            if (triangleScore[t] > triangleScore[bestTriangle])
+                bestTriangle = (int)t;
+
+        while (bestTriangle >= 0)
+        {
+            emitted[bestTriangle] = true;
+            const unsigned int *triangle = &indices[3 * bestTriangle];
+            result.insert(result.end(), triangle, triangle + 3);
+
+            // the triangle's vertices move to the front of the LRU cache
+            nextCache.clear();
+            for (int k = 0; k < 3; k++)
+                if (std::find(nextCache.begin(), nextCache.end(), triangle[k]) == nextCache.end())
+                    nextCache.push_back(triangle[k]);
+            for (size_t i = 0; i < cache.size(); i++)
+                if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+                    nextCache.push_back(cache[i]);
+            for (int k = 0; k < 3; k++)
+            {
+                // degenerate triangles list the same vertex twice, but are only once in its adjacency
+                unsigned int v = triangle[k];
+                unsigned int *first = &adjacency[adjacencyOffset[v]], *last = first + remaining[v];
+                unsigned int *found = std::find(first, last, (unsigned int)bestTriangle);
+                if (found == last)
+                    continue;
+                std::swap(*found, *(last - 1));
+                remaining[v]--;
+            }
+
+            // rescore the vertices whose cache position changed, including the ones pushed out, and their triangles
+            for (size_t i = 0; i < nextCache.size(); i++)
+            {
+                unsigned int v = nextCache[i];
+                int position = i < (size_t)cacheSize ? (int)i : -1;
+                cachePosition[v] = position;
+                float score = forsythScore(position, remaining[v], cacheSize);
+                float delta = score - vertexScore[v];
+                vertexScore[v] = score;
+                for (unsigned int a = 0; a < remaining[v]; a++)
+                    triangleScore[adjacency[adjacencyOffset[v] + a]] += delta;
+            }
+            if (nextCache.size() > (size_t)cacheSize)
+                nextCache.resize(cacheSize);
+            cache.swap(nextCache);
+
+            // next: the best triangle using a cached vertex, or the best remaining one if the cache has nothing left to offer
+            bestTriangle = -1;
+            float bestScore = -1.0f;
+            for (size_t i = 0; i < cache.size(); i++)
+            {
+                unsigned int v = cache[i];
+                for (unsigned int a = 0; a < remaining[v]; a++)
+                {
+                    unsigned int t = adjacency[adjacencyOffset[v] + a];
+                    if (triangleScore[t] > bestScore)
+                    {
+                        bestTriangle = (int)t;
+                        bestScore = triangleScore[t];
+                    }
+                }
+            }
+            if (bestTriangle < 0)
+            {
+                while (scanCursor < triangleCount && emitted[scanCursor])
+                    scanCursor++;
+                if (scanCursor < triangleCount)
+                    bestTriangle = (int)scanCursor;
+            }
+        }
+
+        indices.swap(result);
+    }
+
+    // splits the cache optimized triangles into clusters where the cache restarts anyway, then sorts the clusters so the
+    // ones in front from most of a set of view directions are drawn first. triangles behind them then fail the depth test
+    // instead of being shaded and overwritten
+    template <typename VertexType>
+    static void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<VertexType> &vertices, unsigned int cacheSize = 16)
+    {
+        const unsigned int minClusterSize = 32;
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        // clusters start on triangles whose three vertices all miss the cache, so cutting there costs no extra transforms
+        std::vector<size_t> clusterStart(1, 0);
+        std::vector<unsigned int> loadedAt(vertices.size(), 0);
+        unsigned int transforms = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            int misses = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int &loaded = loadedAt[indices[3 * t + k]];
+                if (loaded == 0 || transforms - loaded >= cacheSize)
+                {
+                    loaded = ++transforms;
+                    misses++;
+                }
+            }
+            if (misses == 3 && t - clusterStart.back() >= minClusterSize)
+                clusterStart.push_back(t);
+        }
+        clusterStart.push_back(triangleCount);
+        size_t clusterCount = clusterStart.size() - 1;
+
+        // area weighted centroid and normal of every cluster
+        std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f)), normals(clusterCount, glm::vec3(0.0f));
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        for (size_t c = 0; c < clusterCount; c++)
+        {
+            float clusterArea = 0.0f;
+            for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+            {
+                glm::vec3 p0 = vertices[indices[3 * t]].Position, p1 = vertices[indices[3 * t + 1]].Position, p2 = vertices[indices[3 * t + 2]].Position;
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(normal);
+                centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+                normals[c] += normal;
+                clusterArea += area;
+            }
+            meshCentroid += centroids[c];
+            meshArea += clusterArea;
+            centroids[c] = clusterArea > 0.0f ? centroids[c] / clusterArea : vertices[indices[3 * clusterStart[c]]].Position;
+            float normalLength = glm::length(normals[c]);
+            normals[c] = normalLength > 0.0f ? normals[c] / normalLength : glm::vec3(0.0f);
+        }
+        if (meshArea > 0.0f)
+            meshCentroid /= meshArea;
+
+        // for every view direction the clusters facing the viewer rank by how far towards the viewer they are
+        const glm::vec3 directions[] = {
+            glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1),
+            glm::vec3(1, 1, 1), glm::vec3(1, 1, -1), glm::vec3(1, -1, 1), glm::vec3(1, -1, -1),
+            glm::vec3(-1, 1, 1), glm::vec3(-1, 1, -1), glm::vec3(-1, -1, 1), glm::vec3(-1, -1, -1)
+        };
+        std::vector<float> clusterScore(clusterCount, 0.0f);
+        for (size_t c = 0; c < clusterCount; c++)
+        {
+            for (unsigned int d = 0; d < sizeof(directions) / sizeof(directions[0]); d++)
+            {
+                glm::vec3 toViewer = glm::normalize(directions[d]);
+                if (glm::dot(normals[c], toViewer) > 0.0f)
+                    clusterScore[c] += glm::dot(centroids[c] - meshCentroid, toViewer);
+            }
+        }
+
+        std::vector<size_t> order(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++)
+            order[c] = c;
+        std::stable_sort(order.begin(), order.end(), [&clusterScore](size_t a, size_t b) { return clusterScore[a] > clusterScore[b]; });
+
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        for (size_t i = 0; i < clusterCount; i++)
+            result.insert(result.end(), indices.begin() + 3 * clusterStart[order[i]], indices.begin() + 3 * clusterStart[order[i] + 1]);
+        indices.swap(result);
+    }
+
+    // renumbers the vertices in the order the index buffer first uses them, dropping the unused ones
+    template <typename VertexType>
+    static void optimizeVertexFetch(std::vector<VertexType> &vertices, std::vector<unsigned int> &indices)
+    {
+        const unsigned int unused = ~0u;
+        std::vector<unsigned int> remap(vertices.size(), unused);
+        std::vector<VertexType> result;
+        result.reserve(vertices.size());
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            unsigned int &newIndex = remap[indices[i]];
+            if (newIndex == unused)
+            {
+                newIndex = (unsigned int)result.size();
+                result.push_back(vertices[indices[i]]);
+            }
+            indices[i] = newIndex;
+        }
+        vertices.swap(result);
+    }
+
+    // splits the index buffer into consecutive clusters of at most maxTriangles triangles and maxVertices unique vertices.
+    // after the cache optimization neighbouring triangles are close in the index buffer, so the clusters are compact
+    template <typename VertexType>
+    static std::vector<MeshCluster> buildClusters(const std::vector<unsigned int> &indices, const std::vector<VertexType> &vertices,
+                                                  unsigned int maxTriangles = 124, unsigned int maxVertices = 64)
+    {
+        std::vector<MeshCluster> clusters;
+        std::vector<unsigned int> clusterOf(vertices.size(), ~0u);
+        size_t start = 0;
+        unsigned int uniqueVertices = 0;
+        for (size_t t = 0; 3 * t < indices.size(); t++)
+        {
+            unsigned int newVertices = 0;
+            for (int k = 0; k < 3; k++)
+                newVertices += clusterOf[indices[3 * t + k]] != clusters.size() ? 1 : 0;
+            if (t > start && (t - start >= maxTriangles || uniqueVertices + newVertices > maxVertices))
+            {
+                clusters.push_back(clusterBounds(indices, vertices, start, t));
+                start = t;
+                uniqueVertices = 0;
+                newVertices = 3;
+            }
+            for (int k = 0; k < 3; k++)
+                clusterOf[indices[3 * t + k]] = (unsigned int)clusters.size();
+            uniqueVertices += newVertices;
+        }
+        if (3 * start < indices.size())
+            clusters.push_back(clusterBounds(indices, vertices, start, indices.size() / 3));
+        return clusters;
+    }
+
+private:
+    // bounding sphere around the box of the triangles, and the cone containing their normals
+    template <typename VertexType>
+    static MeshCluster clusterBounds(const std::vector<unsigned int> &indices, const std::vector<VertexType> &vertices, size_t firstTriangle, size_t endTriangle)
+    {
+        MeshCluster cluster;
+        cluster.firstIndex = (unsigned int)(3 * firstTriangle);
+        cluster.indexCount = (unsigned int)(3 * (endTriangle - firstTriangle));
+
+        glm::vec3 minPosition = vertices[indices[3 * firstTriangle]].Position, maxPosition = minPosition;
+        glm::vec3 axis(0.0f);
+        std::vector<glm::vec3> normals;
+        for (size_t i = 3 * firstTriangle; i < 3 * endTriangle; i += 3)
+        {
+            glm::vec3 p0 = vertices[indices[i]].Position, p1 = vertices[indices[i + 1]].Position, p2 = vertices[indices[i + 2]].Position;
+            minPosition = glm::min(minPosition, glm::min(p0, glm::min(p1, p2)));
+            maxPosition = glm::max(maxPosition, glm::max(p0, glm::max(p1, p2)));
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f)
+            {
+                normals.push_back(normal / length);
+                axis += normal / length;
+            }
+        }
+
+        glm::vec3 center = (minPosition + maxPosition) * 0.5f;
+        float radius = 0.0f;
+        for (size_t i = 3 * firstTriangle; i < 3 * endTriangle; i++)
+            radius = std::max(radius, glm::length(vertices[indices[i]].Position - center));
+        cluster.boundingSphere = glm::vec4(center, radius);
+
+        // the cone can cull when all normals are within 90 degrees of the axis, the cutoff is the sine of the widest angle
+        float axisLength = glm::length(axis);
+        float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+        for (size_t i = 0; i < normals.size() && axisLength > 0.0f; i++)
+            minDot = std::min(minDot, glm::dot(normals[i], axis / axisLength));
+        if (minDot <= 0.0f)
+            cluster.normalCone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        else
+            cluster.normalCone = glm::vec4(axis / axisLength, std::sqrt(1.0f - minDot * minDot));
+        return cluster;
+    }
+
+    static float forsythScore(int cachePosition, unsigned int remainingTriangles, int cacheSize)
+    {
+        // vertices without triangles left are never picked again
+        if (remainingTriangles == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // the last triangle's vertices get a fixed score, so the algorithm doesn't just walk back and forth
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+        }
+        // finish off vertices with few triangles left
+        score += 2.0f / std::sqrt((float)remainingTriangles);
+        return score;
+    }
+};
+#endif
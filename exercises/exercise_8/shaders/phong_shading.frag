@@ -44,7 +44,8 @@ vec3 GetNormalMap()
    // Unpack from range [0, 1] to [-1 , 1]
    normalMap = normalMap * 2.0 - 1.0;
 
-   // This time we are storing Z component in the texture, no need to compute it. Instead we normalize just in case
+   // BC5 compressed normal maps only store X and Y, so Z is computed knowing that the normal length is 1
+   normalMap.z = sqrt(max(1.0 - dot(normalMap.xy, normalMap.xy), 0.0));
    normalMap = normalize(normalMap);
 
    // Create tangent space matrix
@@ -2,6 +2,7 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 
+#include <random>
 #include <vector>
 
 // NEW! as our scene gets more complex, we start using more helper classes
@@ -10,6 +11,8 @@
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "light_clusters.h"
+#include "shadow_map_cache.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -35,6 +38,10 @@ const unsigned int SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
 Shader* shader;
 Shader* phong_shading;
 Shader* pbr_shading;
+// the shading models with CLUSTERED_LIGHTS, all the point lights in one pass
+Shader* phong_shading_clustered;
+Shader* pbr_shading_clustered;
+LightClusters* lightClusters; // point lights binned into clusters of the view frustum
 Shader* shadowMap_shader;
 Model* carBodyModel;
 Model* carPaintModel;
@@ -57,6 +64,12 @@ unsigned int cubemapTexture; // skybox texture handle
 
 unsigned int shadowMap, shadowMapFBO;
 glm::mat4 lightSpaceMatrix;
+ShadowMapCache* shadowMapCache; // draws the shadow map again only when it changed
+
+// incremented when objects are added, removed or moved, the wheels are the only dynamic objects
+unsigned int staticSceneVersion = 0;
+unsigned int dynamicSceneVersion = 0;
+float wheelAngle = 0.0f;
 
 // global variables used for control
 // ---------------------------------
@@ -113,6 +126,16 @@ struct Config
 
     std::vector<Light> lights;
 
+    // shade the point lights in the same pass as light 1, each fragment with the lights of its cluster
+    bool clusteredShading = true;
+    // random point lights added to the two above
+    int extraLightCount = 0;
+
+    // keep the shadow map while the light and the objects stay where they are
+    bool cacheShadowMap = true;
+    // radians per second, moving wheels are drawn over a cached shadow map of the rest
+    float wheelSpeed = 0.0f;
+
 } config;
 
 
@@ -120,11 +143,12 @@ struct Config
 // ---------------------
 void setAmbientUniforms(glm::vec3 ambientLightColor);
 void setLightUniforms(Light &light);
+void updateExtraLights();
 void setupForwardAdditionalPass();
 void resetForwardAdditionalPass();
 void drawSkybox();
 void drawShadowMap();
-void drawObjects();
+void drawObjects(bool drawStatic = true, bool drawDynamic = true);
 void drawGui();
 unsigned int initSkyboxBuffers();
 unsigned int loadCubemap(vector<std::string> faces);
@@ -173,7 +197,10 @@ int main()
     // ----------------------------------
     phong_shading = new Shader("shaders/common_shading.vert", "shaders/phong_shading.frag");
     pbr_shading = new Shader("shaders/common_shading.vert", "shaders/pbr_shading.frag");
+    phong_shading_clustered = new Shader("shaders/common_shading.vert", "shaders/phong_shading.frag", nullptr, true, {"CLUSTERED_LIGHTS"});
+    pbr_shading_clustered = new Shader("shaders/common_shading.vert", "shaders/pbr_shading.frag", nullptr, true, {"CLUSTERED_LIGHTS"});
     shader = pbr_shading;
+    lightClusters = new LightClusters();
 
     carBodyModel = new Model("car/Body_LOD0.obj");
     carPaintModel = new Model("car/Paint_LOD0.obj");
@@ -198,6 +225,7 @@ int main()
     skyboxShader = new Shader("shaders/skybox.vert", "shaders/skybox.frag");
 
     createShadowMap();
+    shadowMapCache = new ShadowMapCache(shadowMapFBO, SHADOW_WIDTH, SHADOW_HEIGHT);
     shadowMap_shader = new Shader("shaders/shadowmap.vert", "shaders/shadowmap.frag");
 
     // set up the z-buffer
@@ -240,6 +268,14 @@ int main()
             glm::vec4 rotatedLight = glm::rotate(glm::mat4(1.0f), lightRotationSpeed * deltaTime, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(config.lights[1].position, 1.0f);
             config.lights[1].position = glm::vec3(rotatedLight.x, rotatedLight.y, rotatedLight.z);
         }
+        updateExtraLights();
+
+        // Spin the wheels
+        if (config.wheelSpeed != 0.0f)
+        {
+            wheelAngle += config.wheelSpeed * deltaTime;
+            dynamicSceneVersion++;
+        }
 
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -249,22 +285,46 @@ int main()
 
         drawShadowMap();
 
+        // the clustered version of the shading model adds the other lights to the pass of the first one, the scene
+        // is drawn once
+        Shader* currShader = shader;
+        bool clustered = config.clusteredShading;
+        if (clustered)
+            shader = shader == pbr_shading ? pbr_shading_clustered : phong_shading_clustered;
+
         shader->use();
 
         // First light + ambient
         setAmbientUniforms(config.ambientLightColor * config.ambientLightIntensity);
         setLightUniforms(config.lights[0]);
         setShadowUniforms();
+        if (clustered)
+        {
+            // the same energy as setLightUniforms gives the lights
+            float energyScale = shader == pbr_shading_clustered ? glm::pi<float>() : 1.0f;
+            lightClusters->Clear();
+            for (int i = 1; i < config.lights.size(); ++i)
+            {
+                const Light &light = config.lights[i];
+                lightClusters->AddLight(light.position, light.radius, light.color * light.intensity * energyScale);
+            }
+            lightClusters->Build(view, projection, 0.1f, 100.0f);
+            lightClusters->Bind(*shader, 7);
+        }
         drawObjects();
 
         // Additional additive lights
-        setupForwardAdditionalPass();
-        for (int i = 1; i < config.lights.size(); ++i)
+        if (!clustered)
         {
-            setLightUniforms(config.lights[i]);
-            drawObjects();
+            setupForwardAdditionalPass();
+            for (int i = 1; i < config.lights.size(); ++i)
+            {
+                setLightUniforms(config.lights[i]);
+                drawObjects();
+            }
+            resetForwardAdditionalPass();
         }
-        resetForwardAdditionalPass();
+        shader = currShader;
 
         if (isPaused) {
             drawGui();
@@ -289,7 +349,11 @@ int main()
     delete floorModel;
     delete phong_shading;
     delete pbr_shading;
+    delete phong_shading_clustered;
+    delete pbr_shading_clustered;
+    delete lightClusters;
     delete shadowMap_shader;
+    delete shadowMapCache;
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -325,6 +389,10 @@ void drawGui(){
         ImGui::SliderFloat("light 2 intensity", &config.lights[1].intensity, 0.0f, 2.0f);
         ImGui::SliderFloat("light 2 radius", &config.lights[1].radius, 0.01f, 50.0f);
         ImGui::SliderFloat("light 2 speed", &lightRotationSpeed, 0.0f, 2.0f);
+        ImGui::SliderInt("extra point lights", &config.extraLightCount, 0, 4096);
+        ImGui::Checkbox("clustered shading", &config.clusteredShading);
+        if (config.clusteredShading)
+            ImGui::Text("%u light indices in %u clusters", lightClusters->IndexCount(), lightClusters->ClusterCount());
         ImGui::Separator();
 
         ImGui::Text("Car paint material: ");
@@ -339,6 +407,11 @@ void drawGui(){
         ImGui::SliderFloat("metalness", &config.metalness, 0.0f, 1.0f);
         ImGui::Separator();
 
+        ImGui::SliderFloat("wheel speed", &config.wheelSpeed, -10.0f, 10.0f);
+        ImGui::Checkbox("cache shadow map", &config.cacheShadowMap);
+        ImGui::Text("shadow map: %u static, %u dynamic passes, %u skipped", shadowMapCache->StaticDraws(), shadowMapCache->DynamicDraws(), shadowMapCache->SkippedUpdates());
+        ImGui::Separator();
+
         ImGui::Text("Shading model: ");
         {
             if (ImGui::RadioButton("Blinn-Phong Shading", shader == phong_shading)) { shader = phong_shading; }
@@ -365,7 +438,7 @@ void setLightUniforms(Light& light)
     glm::vec3 lightEnergy = light.color * light.intensity;
 
     // TODO 8.3 : if we are using the PBR shader, multiply the lightEnergy by PI to match the color of the previous setup
-    if (shader == pbr_shading)
+    if (shader == pbr_shading || shader == pbr_shading_clustered)
     {
         lightEnergy *= glm::pi<float>();
     }
@@ -376,6 +449,25 @@ void setLightUniforms(Light& light)
     shader->setFloat("lightRadius", light.radius);
 }
 
+void updateExtraLights()
+{
+    // lights 1 and 2 come first, the extra ones are added or removed at the end
+    const size_t lightCount = 2 + (size_t)std::max(config.extraLightCount, 0);
+    if (config.lights.size() > lightCount)
+        config.lights.erase(config.lights.begin() + lightCount, config.lights.end());
+
+    // scattered around the car, each one placed from its index so it stays where it was when the count changes
+    while (config.lights.size() < lightCount)
+    {
+        // braces evaluate the draws left to right, the order of unspecified argument evaluation would differ per compiler
+        std::mt19937 random((unsigned int)config.lights.size());
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        glm::vec3 position{unit(random) * 12.0f - 6.0f, 0.1f + unit(random) * 1.5f, unit(random) * 12.0f - 6.0f};
+        glm::vec3 color{unit(random), unit(random), unit(random)};
+        config.lights.emplace_back(position, color, 0.5f, 0.5f + unit(random) * 1.5f);
+    }
+}
+
 void setupForwardAdditionalPass()
 {
     // Remove ambient from additional passes
@@ -485,33 +577,42 @@ unsigned int initSkyboxBuffers() {
 // -------------------------------------------------------
 unsigned int loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrComponents;
+    // the six faces are converted once into a container with all their mip levels, later runs only map it
+    std::string containerFile = TextureContainer::containerPath(faces[0] + ".cube", true);
+    bool upToDate = true;
     for (unsigned int i = 0; i < faces.size(); i++)
+        upToDate = upToDate && TextureContainer::isUpToDate(containerFile, faces[i]);
+
+    TextureContainer container;
+    if (!upToDate || !container.load(containerFile))
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        // decode the six faces in parallel
+        vector<DecodedImage> images = ImageDecoder::decode(faces, 3);
+        bool complete = true;
+        for (unsigned int i = 0; i < images.size(); i++)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_SRGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            if (!images[i].data)
+            {
+                std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+                complete = false;
+            }
         }
-        else
+        if (complete)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            container = TextureContainer::fromImages(images, true, TextureContainer::defaultCompression(3));
+            container.write(containerFile);
         }
+        for (unsigned int i = 0; i < images.size(); i++)
+            images[i].free();
     }
+
+    unsigned int textureID = container.upload();
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
     return textureID;
@@ -584,6 +685,16 @@ void drawShadowMap()
     lightSpaceMatrix = lightProjection * lightView;
     shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
 
+    // nothing is drawn if the light and the objects didn't change since the last time
+    if (config.cacheShadowMap)
+    {
+        shadowMapCache->Update(lightSpaceMatrix, staticSceneVersion, dynamicSceneVersion,
+                               []() { drawObjects(true, false); }, []() { drawObjects(false, true); });
+        shader = currShader;
+        return;
+    }
+    shadowMapCache->Invalidate();
+
     // setup framebuffer size
     int viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
@@ -618,7 +729,8 @@ void setShadowUniforms()
     //shader->setFloat("shadowBias", config.shadowBias * 0.01f);
 }
 
-void drawObjects()
+// the static objects, the dynamic ones (the wheels), or both
+void drawObjects(bool drawStatic, bool drawDynamic)
 {
     // the typical transformation uniforms are already set for you, these are:
     // projection (perspective projection matrix)
@@ -651,7 +763,8 @@ void drawObjects()
 
     glm::mat4 model = glm::mat4(1.0f);
     shader->setMat4("model", model);
-    carPaintModel->Draw(*shader);
+    if (drawStatic)
+        carPaintModel->Draw(*shader);
 
     // material uniforms for other car parts (hardcoded)
     shader->setVec3("reflectionColor", 1.0f, 1.0f, 1.0f);
@@ -662,41 +775,52 @@ void drawObjects()
     shader->setFloat("roughness", 0.5f);
     shader->setFloat("metalness", 0.0f);
 
-    carBodyModel->Draw(*shader);
-
-    // draw car
-    shader->setMat4("model", model);
-    carLightModel->Draw(*shader);
-    carInteriorModel->Draw(*shader);
-
-    // draw wheel
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, 1.39f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
-
-    // draw wheel
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, -1.39f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+    if (drawStatic)
+    {
+        carBodyModel->Draw(*shader);
 
-    // draw wheel
-    model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
-    model = glm::translate(model, glm::vec3(-.7432f, .328f, 1.39f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+        // draw car
+        shader->setMat4("model", model);
+        carLightModel->Draw(*shader);
+        carInteriorModel->Draw(*shader);
+    }
 
-    // draw wheel
-    model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
-    model = glm::translate(model, glm::vec3(-.7432f, .328f, -1.39f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+    if (drawDynamic)
+    {
+        // the wheels turn around their axle, the ones on the other side are mirrored so they turn the other way
+        glm::mat4 spin = glm::rotate(glm::mat4(1.0f), wheelAngle, glm::vec3(1.0, 0.0, 0.0));
+        glm::mat4 mirroredSpin = glm::rotate(glm::mat4(1.0f), -wheelAngle, glm::vec3(1.0, 0.0, 0.0));
+
+        // draw wheel
+        model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, 1.39f)) * spin;
+        shader->setMat4("model", model);
+        carWheelModel->Draw(*shader);
+
+        // draw wheel
+        model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, -1.39f)) * spin;
+        shader->setMat4("model", model);
+        carWheelModel->Draw(*shader);
+
+        // draw wheel
+        model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
+        model = glm::translate(model, glm::vec3(-.7432f, .328f, 1.39f)) * mirroredSpin;
+        shader->setMat4("model", model);
+        carWheelModel->Draw(*shader);
+
+        // draw wheel
+        model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
+        model = glm::translate(model, glm::vec3(-.7432f, .328f, -1.39f)) * mirroredSpin;
+        shader->setMat4("model", model);
+        carWheelModel->Draw(*shader);
+    }
 
     // draw floor
     model = glm::scale(glm::mat4(1.0), glm::vec3(5.f, 5.f, 5.f));
     shader->setMat4("model", model);
     shader->setFloat("specularReflectance", 0.2f);
     shader->setFloat("roughness", 0.95f);
-    floorModel->Draw(*shader);
+    if (drawStatic)
+        floorModel->Draw(*shader);
 
     shader->setFloat("specularReflectance", 1.0f);
     shader->setFloat("specularExponent", 20.0f);
@@ -704,7 +828,8 @@ void drawObjects()
     model = glm::mat4(1.0f);
     shader->setMat4("model", model);
 
-    carWindowsModel->Draw(*shader);
+    if (drawStatic)
+        carWindowsModel->Draw(*shader);
 }
 
 void processInput(GLFWwindow *window) {
@@ -0,0 +1,191 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// keeps linked programs on disk as glGetProgramBinary blobs, so the next run loads them instead of compiling GLSL.
+// a program is found by a hash of its sources together with the vendor, renderer and version strings of the driver,
+// so editing a shader or updating the driver gives a new key. the driver can still refuse a binary, then load fails
+// and the caller compiles the sources as usual
+class ProgramCache
+{
+public:
+    static ProgramCache& instance()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    // folder the binaries are written to, relative to the working directory
+    void setDirectory(const std::string &path)
+    {
+        directory = path;
+    }
+
+    // program binaries are core in GL 4.1, and the driver may still support no binary format at all
+    bool supported()
+    {
+        if (formatCount < 0)
+        {
+            formatCount = 0;
+            if (GLAD_GL_VERSION_4_1)
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        }
+        return formatCount > 0;
+    }
+
+    // the key of a program made of these sources, in the order of its stages. empty sources are skipped
+    std::string key(const std::vector<std::string> &sources)
+    {
+        if (driver.empty())
+            driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+
+        // 64 bit FNV-1a, over the driver and every source with its position
+        uint64_t hash = 14695981039346656037ULL;
+        hashBytes(hash, driver.data(), driver.size());
+        for (unsigned int i = 0; i < sources.size(); i++)
+        {
+            if (sources[i].empty())
+                continue;
+            hashBytes(hash, &i, sizeof(i));
+            hashBytes(hash, sources[i].data(), sources[i].size());
+        }
+        char text[17];
+        std::snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+        return text;
+    }
+
+    // creates a program from the binary stored for the key, or returns 0 if there is none or the driver rejects it
+    GLuint load(const std::string &key)
+    {
+        if (!supported())
+            return 0;
+        std::ifstream file(path(key).c_str(), std::ios::binary);
+        if (!file)
+        {
+            misses++;
+            return 0;
+        }
+
+        uint32_t magic = 0;
+        GLenum format = 0;
+        file.read((char*)&magic, sizeof(magic));
+        file.read((char*)&format, sizeof(format));
+        std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file || magic != MAGIC || binary.empty())
+        {
+            misses++;
+            return 0;
+        }
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, format, &binary[0], (GLsizei)binary.size());
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            glDeleteProgram(program);
+            misses++;
+            return 0;
+        }
+        hits++;
+        return program;
+    }
+
+    // call before linking a program that will be stored, some drivers only keep the binary when asked to
+    void prepare(GLuint program)
+    {
+        if (supported())
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // writes the binary of a linked program under the key
+    void store(GLuint program, const std::string &key)
+    {
+        if (!supported())
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+        createDirectory();
+        std::ofstream file(path(key).c_str(), std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::PROGRAM_CACHE: can't write " << path(key) << std::endl;
+            return;
+        }
+        uint32_t magic = MAGIC;
+        file.write((const char*)&magic, sizeof(magic));
+        file.write((const char*)&format, sizeof(format));
+        file.write(&binary[0], length);
+    }
+
+    // programs loaded from the cache, and programs that had to be compiled
+    unsigned int hitCount() const { return hits.load(); }
+    unsigned int missCount() const { return misses.load(); }
+
+    // the cache is a process-wide singleton
+    ProgramCache(const ProgramCache&) = delete;
+    ProgramCache& operator=(const ProgramCache&) = delete;
+
+private:
+    ProgramCache() : directory("shader_cache"), formatCount(-1), hits(0), misses(0) {}
+
+    static const uint32_t MAGIC = 0x42505247; // "GRPB"
+
+    std::string directory;
+    std::string driver;
+    GLint formatCount; // -1 until queried
+    std::atomic<unsigned int> hits, misses; // programs can be built on several threads
+
+    std::string path(const std::string &key) const
+    {
+        return directory + "/" + key + ".bin";
+    }
+
+    void createDirectory() const
+    {
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+    }
+
+    static std::string glString(GLenum name)
+    {
+        const GLubyte *value = glGetString(name);
+        return value ? std::string((const char*)value) : std::string();
+    }
+
+    static void hashBytes(uint64_t &hash, const void *data, size_t size)
+    {
+        const unsigned char *bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+};
+#endif
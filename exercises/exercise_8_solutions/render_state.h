@@ -0,0 +1,185 @@
+#ifndef RENDER_STATE_H
+#define RENDER_STATE_H
+
+#include <glad/glad.h>
+
+#include <utility>
+#include <vector>
+
+// shadows the GL state the render loops change most often, texture bindings, capabilities, face culling, depth and blend
+// functions, and only calls GL when a value actually changes. it counts the calls that went to the driver and the ones
+// it skipped.
+// caching is off by default and then every call goes through. code that changes the same state with plain GL calls
+// while caching is on must call invalidate() afterwards, or the cache will skip calls that are needed
+class RenderState
+{
+public:
+    static RenderState& instance()
+    {
+        static RenderState state;
+        return state;
+    }
+
+    // turning caching on starts from unknown state, so the first call of each kind always goes through
+    void setCaching(bool enabled)
+    {
+        caching = enabled;
+        invalidate();
+    }
+
+    bool cachingEnabled() const { return caching; }
+
+    // forgets the shadowed state, after GL calls that didn't go through the cache
+    void invalidate()
+    {
+        activeUnit = UNKNOWN;
+        for (unsigned int i = 0; i < textures.size(); i++)
+            textures[i] = UNKNOWN;
+        capabilities.clear();
+        cullMode = UNKNOWN;
+        depthWrite = UNKNOWN;
+        depthFunction = UNKNOWN;
+        blendSource = UNKNOWN;
+        blendDestination = UNKNOWN;
+    }
+
+    // unit is the index of the texture unit, not GL_TEXTUREi
+    void activeTexture(GLuint unit)
+    {
+        if (skip(activeUnit == unit))
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+    }
+
+    // binds to the unit, switching units only when the texture isn't bound there yet
+    void bindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        int slot = targetSlot(target);
+        if (slot < 0)
+        {
+            // targets the cache doesn't track always go through
+            activeTexture(unit);
+            issued++;
+            glBindTexture(target, texture);
+            return;
+        }
+        size_t index = (size_t)unit * TARGET_COUNT + slot;
+        if (index >= textures.size())
+            textures.resize(index + TARGET_COUNT, (GLuint)UNKNOWN);
+        if (skip(textures[index] == texture))
+            return;
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        textures[index] = texture;
+    }
+
+    void enable(GLenum capability) { setCapability(capability, true); }
+    void disable(GLenum capability) { setCapability(capability, false); }
+
+    void cullFace(GLenum mode)
+    {
+        if (skip(cullMode == mode))
+            return;
+        glCullFace(mode);
+        cullMode = mode;
+    }
+
+    void depthMask(bool write)
+    {
+        if (skip(depthWrite == (GLuint)write))
+            return;
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+        depthWrite = write;
+    }
+
+    void depthFunc(GLenum function)
+    {
+        if (skip(depthFunction == function))
+            return;
+        glDepthFunc(function);
+        depthFunction = function;
+    }
+
+    void blendFunc(GLenum source, GLenum destination)
+    {
+        if (skip(blendSource == source && blendDestination == destination))
+            return;
+        glBlendFunc(source, destination);
+        blendSource = source;
+        blendDestination = destination;
+    }
+
+    // calls that reached the driver, and calls the cache left out, since the last resetCounters
+    unsigned int issuedCalls() const { return issued; }
+    unsigned int skippedCalls() const { return skipped; }
+
+    void resetCounters()
+    {
+        issued = 0;
+        skipped = 0;
+    }
+
+    // the state is a process-wide singleton, like the context it shadows
+    RenderState(const RenderState&) = delete;
+    RenderState& operator=(const RenderState&) = delete;
+
+private:
+    RenderState() : caching(false), issued(0), skipped(0)
+    {
+        invalidate();
+    }
+
+    // no GL object, unit or enum has this value
+    static const GLuint UNKNOWN = 0xFFFFFFFF;
+    static const int TARGET_COUNT = 4;
+
+    bool caching;
+    unsigned int issued, skipped;
+    GLuint activeUnit;
+    std::vector<GLuint> textures; // bound texture per unit and target slot
+    std::vector<std::pair<GLenum, bool> > capabilities; // only the ones set since the last invalidate
+    GLuint cullMode, depthWrite, depthFunction, blendSource, blendDestination;
+
+    // counts the call, and tells if it can be left out
+    bool skip(bool unchanged)
+    {
+        if (caching && unchanged)
+        {
+            skipped++;
+            return true;
+        }
+        issued++;
+        return false;
+    }
+
+    void setCapability(GLenum capability, bool enabled)
+    {
+        unsigned int i = 0;
+        while (i < capabilities.size() && capabilities[i].first != capability)
+            i++;
+        if (skip(i < capabilities.size() && capabilities[i].second == enabled))
+            return;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+        if (i < capabilities.size())
+            capabilities[i].second = enabled;
+        else
+            capabilities.push_back(std::make_pair(capability, enabled));
+    }
+
+    static int targetSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_CUBE_MAP: return 1;
+        case GL_TEXTURE_2D_ARRAY: return 2;
+        case GL_TEXTURE_3D: return 3;
+        default: return -1;
+        }
+    }
+};
+#endif
@@ -0,0 +1,135 @@
+#ifndef SHADOW_MAP_CACHE_H
+#define SHADOW_MAP_CACHE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <functional>
+
+// skips the shadow pass when nothing it depends on changed: the light matrix, and the version counters of the static
+// and the dynamic objects, which the application increments when they change. while only dynamic objects move, the
+// static ones come from a depth texture of their own, copied into the shadow map before the dynamic ones are drawn on
+// top. that copy is made the first time it is needed, a scene without moving objects draws everything in one pass
+class ShadowMapCache
+{
+public:
+    // framebuffer is the one of the shadow map, with a GL_DEPTH_COMPONENT texture of width x height
+    ShadowMapCache(GLuint framebuffer, GLsizei width, GLsizei height)
+        : framebuffer(framebuffer), width(width), height(height), staticTexture(0), staticFramebuffer(0),
+          valid(false), staticCopyValid(false), staticVersion(0), dynamicVersion(0),
+          staticDraws(0), dynamicDraws(0), skippedUpdates(0)
+    {
+    }
+
+    ~ShadowMapCache()
+    {
+        glDeleteFramebuffers(1, &staticFramebuffer);
+        glDeleteTextures(1, &staticTexture);
+    }
+
+    // the cache owns GL objects, so it can't be copied
+    ShadowMapCache(const ShadowMapCache&) = delete;
+    ShadowMapCache& operator=(const ShadowMapCache&) = delete;
+
+    // the shadow program is in use and has the light matrix. returns false if the shadow map was still up to date
+    bool Update(const glm::mat4 &lightSpaceMatrix, unsigned int staticVersion, unsigned int dynamicVersion,
+                const std::function<void()> &drawStatic, const std::function<void()> &drawDynamic)
+    {
+        bool staticChanged = !valid || lightSpaceMatrix != this->lightSpaceMatrix || staticVersion != this->staticVersion;
+        bool dynamicChanged = dynamicVersion != this->dynamicVersion;
+        if (!staticChanged && !dynamicChanged)
+        {
+            skippedUpdates++;
+            return false;
+        }
+        valid = true;
+        this->lightSpaceMatrix = lightSpaceMatrix;
+        this->staticVersion = staticVersion;
+        this->dynamicVersion = dynamicVersion;
+
+        // setup framebuffer size
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, width, height);
+
+        if (staticChanged)
+        {
+            // everything in one pass, the static copy is out of date until dynamic objects move again
+            staticCopyValid = false;
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            drawStatic();
+            staticDraws++;
+        }
+        else
+        {
+            if (!staticCopyValid)
+            {
+                if (staticFramebuffer == 0)
+                    createStaticCopy();
+                glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                drawStatic();
+                staticDraws++;
+                staticCopyValid = true;
+            }
+
+            // start from the static objects instead of drawing them again
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        }
+        drawDynamic();
+        dynamicDraws++;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        return true;
+    }
+
+    // draws everything again on the next Update, e.g. after the shadow program changed
+    void Invalidate()
+    {
+        valid = false;
+    }
+
+    // passes drawing the static objects, passes drawing the dynamic ones, and updates that drew nothing
+    unsigned int StaticDraws() const { return staticDraws; }
+    unsigned int DynamicDraws() const { return dynamicDraws; }
+    unsigned int SkippedUpdates() const { return skippedUpdates; }
+
+private:
+    GLuint framebuffer;
+    GLsizei width, height;
+    GLuint staticTexture, staticFramebuffer;
+
+    glm::mat4 lightSpaceMatrix;
+    bool valid, staticCopyValid;
+    unsigned int staticVersion, dynamicVersion;
+
+    unsigned int staticDraws, dynamicDraws, skippedUpdates;
+
+    // same format as the shadow map, so depth can be blitted between them
+    void createStaticCopy()
+    {
+        // the texture binding is put back, it may be cached by the caller
+        GLint boundTexture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+
+        glGenTextures(1, &staticTexture);
+        glBindTexture(GL_TEXTURE_2D, staticTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, (GLuint)boundTexture);
+
+        glGenFramebuffers(1, &staticFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, staticTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+};
+#endif
@@ -0,0 +1,758 @@
+#ifndef TEXTURE_CONTAINER_H
+#define TEXTURE_CONTAINER_H
+
+#include <glad/glad.h>
+#include <image_decoder.h>
+#include <render_state.h>
+#include <upload_queue.h>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// the S3TC formats come from EXT_texture_compression_s3tc and EXT_texture_sRGB, glad may have been generated without them
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() : bytes(nullptr), length(0) {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile &&other) : bytes(other.bytes), length(other.length)
+    {
+        other.bytes = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile& operator=(MappedFile &&other)
+    {
+        if (this != &other)
+        {
+            close();
+            bytes = other.bytes;
+            length = other.length;
+            other.bytes = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping)
+            {
+                // the view keeps the mapping alive
+                bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                length = bytes ? (size_t)fileSize.QuadPart : 0;
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat info;
+        if (fstat(file, &info) == 0 && info.st_size > 0)
+        {
+            void *view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (view != MAP_FAILED)
+            {
+                bytes = (const unsigned char*)view;
+                length = (size_t)info.st_size;
+            }
+        }
+        // the mapping stays valid after closing the descriptor
+        ::close(file);
+#endif
+        return bytes != nullptr;
+    }
+
+    void close()
+    {
+        if (bytes)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(bytes);
+#else
+            munmap((void*)bytes, length);
+#endif
+        }
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes;
+    size_t length;
+};
+
+// GPU-ready texture stored in the KTX 1.1 file format: all the mip levels are precomputed and optionally block compressed,
+// so loading it is only copying the levels to the GPU. files are memory-mapped and uploaded straight from the mapping
+class TextureContainer
+{
+public:
+    enum Compression
+    {
+        None,
+        BC1, // RGB, 4 bits per pixel
+        BC3, // RGBA, 8 bits per pixel
+        BC5  // two channels (e.g. normals), 8 bits per pixel
+    };
+
+    TextureContainer() : type(0), format(0), internalFormat(0), width(0), height(0), faceCount(0) {}
+
+    // builds all the mip levels of a 2D texture from one image, or of a cube map from six (in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order).
+    // all the images must have the same size and number of components. doesn't use OpenGL, so it can run on worker threads
+    static TextureContainer fromImages(const std::vector<DecodedImage> &images, bool srgb, Compression compression)
+    {
+        TextureContainer container;
+        if (images.size() != 1 && images.size() != 6)
+            return container;
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (!images[i].data || images[i].width != images[0].width || images[i].height != images[0].height ||
+                images[i].components != images[0].components)
+                return container;
+        }
+
+        int imageWidth = images[0].width, imageHeight = images[0].height, components = images[0].components;
+        // only color channels are stored in sRGB
+        srgb = srgb && components >= 3;
+
+        uint32_t levelCount = 1;
+        while ((std::max(imageWidth, imageHeight) >> levelCount) > 0)
+            levelCount++;
+
+        uint32_t header[13] = {
+            0x04030201,                                             // endianness
+            compression == None ? GL_UNSIGNED_BYTE : 0u,            // glType
+            1,                                                      // glTypeSize
+            compression == None ? baseFormat(components) : 0u,      // glFormat
+            sizedFormat(components, srgb, compression),             // glInternalFormat
+            compression == None ? baseFormat(components) :          // glBaseInternalFormat
+                compression == BC5 ? GL_RG : compression == BC1 ? GL_RGB : GL_RGBA,
+            (uint32_t)imageWidth, (uint32_t)imageHeight, 0,         // pixelWidth, pixelHeight, pixelDepth
+            0,                                                      // numberOfArrayElements
+            (uint32_t)images.size(),                                // numberOfFaces
+            levelCount,                                             // numberOfMipmapLevels
+            0                                                       // bytesOfKeyValueData
+        };
+
+        std::vector<unsigned char> &bytes = container.storage;
+        bytes.insert(bytes.end(), fileIdentifier(), fileIdentifier() + 12);
+        appendBytes(bytes, header, sizeof(header));
+
+        std::vector<std::vector<unsigned char> > pixels(images.size());
+        for (size_t face = 0; face < images.size(); face++)
+            pixels[face].assign(images[face].data, images[face].data + (size_t)imageWidth * imageHeight * components);
+
+        int levelWidth = imageWidth, levelHeight = imageHeight;
+        for (uint32_t level = 0; level < levelCount; level++)
+        {
+            // faces are laid out back to back, every one of them imageSize bytes long
+            uint32_t imageSize = (uint32_t)levelSize(levelWidth, levelHeight, components, compression);
+            appendBytes(bytes, &imageSize, sizeof(imageSize));
+            for (size_t face = 0; face < pixels.size(); face++)
+            {
+                if (compression == None)
+                    appendRows(bytes, pixels[face], levelWidth, levelHeight, components);
+                else
+                    appendBlocks(bytes, pixels[face], levelWidth, levelHeight, components, compression);
+            }
+
+            if (level + 1 < levelCount)
+            {
+                for (size_t face = 0; face < pixels.size(); face++)
+                    pixels[face] = downsample(pixels[face], levelWidth, levelHeight, components, srgb);
+                levelWidth = std::max(1, levelWidth / 2);
+                levelHeight = std::max(1, levelHeight / 2);
+            }
+        }
+
+        if (!container.parse(bytes.data(), bytes.size()))
+            container = TextureContainer();
+        return container;
+    }
+
+    // memory-maps a container file. fails if the file is not a container that can be uploaded on this machine
+    bool load(const std::string &path)
+    {
+        *this = TextureContainer();
+        if (!mapping.open(path) || !parse(mapping.data(), mapping.size()))
+        {
+            *this = TextureContainer();
+            return false;
+        }
+        return true;
+    }
+
+    // the folder of the path is created if it doesn't exist yet
+    bool write(const std::string &path) const
+    {
+        if (!valid())
+            return false;
+        std::string::size_type separator = path.find_last_of("/\\");
+        if (separator != std::string::npos)
+            createDirectory(path.substr(0, separator));
+        std::ofstream file(path.c_str(), std::ios::binary);
+        file.write((const char*)bytes(), (std::streamsize)byteCount());
+        return (bool)file;
+    }
+
+    // creates a texture (2D or cube map) holding all the levels and leaves it bound on unit 0. returns 0 if the container is empty.
+    // when the upload queue streams, only the smallest level is uploaded right away. the others follow from small to large,
+    // lowering the base level as each one lands, so the texture starts out blurry and sharpens over a few frames
+    unsigned int upload() const
+    {
+        if (!valid())
+            return 0;
+
+        GLenum target = isCubemap() ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        // bound on unit 0 through the render state, so its cache stays right when caching is on
+        RenderState &renderState = RenderState::instance();
+        renderState.bindTexture(0, target, textureID);
+
+        // uncompressed rows are padded to 4 bytes, as the default unpack alignment expects
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        UploadQueue &queue = UploadQueue::instance();
+        bool streamed = queue.streaming();
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            const Level &mip = levels[level];
+            for (int face = 0; face < faceCount; face++)
+            {
+                GLenum faceTarget = isCubemap() ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+                const unsigned char *data = bytes() + mip.offset + face * mip.stride;
+                // streamed levels only get their storage here
+                if (streamed && level + 1 < levels.size())
+                    data = NULL;
+                if (type == 0)
+                    glCompressedTexImage2D(faceTarget, (GLint)level, internalFormat, mip.width, mip.height, 0, (GLsizei)mip.size, data);
+                else
+                    glTexImage2D(faceTarget, (GLint)level, (GLint)internalFormat, mip.width, mip.height, 0, format, type, data);
+            }
+        }
+        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, streamed ? (GLint)levels.size() - 1 : 0);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+
+        for (size_t level = levels.size() - 1; streamed && level-- > 0; )
+        {
+            const Level &mip = levels[level];
+            for (int face = 0; face < faceCount; face++)
+            {
+                GLenum faceTarget = isCubemap() ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+                // the faces land in order, the level can be sampled after the last one
+                std::function<void()> done;
+                if (face + 1 == faceCount)
+                    done = [textureID, target, level]() { RenderState::instance().bindTexture(0, target, textureID); glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, (GLint)level); };
+                queue.uploadTexture(textureID, target, faceTarget, (GLint)level, mip.width, mip.height, type == 0 ? internalFormat : format, type,
+                                    bytes() + mip.offset + face * mip.stride, mip.size, done);
+            }
+        }
+        renderState.bindTexture(0, target, textureID);
+
+        return textureID;
+    }
+
+    bool valid() const { return !levels.empty(); }
+    bool isCubemap() const { return faceCount == 6; }
+    size_t levelCount() const { return levels.size(); }
+
+    // folder the converted containers are written to, relative to the working directory, so the asset folders stay untouched
+    static void setCacheDirectory(const std::string &path)
+    {
+        cacheDirectory() = path;
+    }
+
+    // block compression of the converted textures, on by default. call it before loading any texture
+    static void setCompression(bool enabled)
+    {
+        compressionSetting() = enabled;
+    }
+
+    static bool compressionEnabled() { return compressionSetting(); }
+
+    // where the container converted from an image file is stored. the name keeps the one of the file, with the hash of its
+    // whole path for files of the same name in different folders, and the options it was converted with
+    static std::string containerPath(const std::string &sourcePath, bool srgb, bool normalMap = false)
+    {
+        // 64 bit FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < sourcePath.size(); i++)
+            hash = (hash ^ (unsigned char)sourcePath[i]) * 1099511628211ULL;
+        char hashText[17];
+        std::snprintf(hashText, sizeof(hashText), "%016llx", (unsigned long long)hash);
+
+        std::string name = sourcePath.substr(sourcePath.find_last_of("/\\") + 1);
+        return cacheDirectory() + "/" + name + "." + hashText + (srgb ? ".srgb" : "") + (normalMap ? ".normal" : "") +
+               (compressionEnabled() ? ".bc" : "") + ".ktx";
+    }
+
+    // true if the container exists and is newer than the file it was converted from
+    static bool isUpToDate(const std::string &containerFile, const std::string &sourceFile)
+    {
+        struct stat container, source;
+        if (stat(containerFile.c_str(), &container) != 0)
+            return false;
+        // a container shipped without its source image is used as is
+        if (stat(sourceFile.c_str(), &source) != 0)
+            return true;
+        return container.st_mtime >= source.st_mtime;
+    }
+
+    // the block compression used for images with this many components, None if it is off or the GPU can't sample it.
+    // normal maps only keep X and Y, in BC5, and the shaders compute Z
+    static Compression defaultCompression(int components, bool normalMap = false)
+    {
+        if (!compressionEnabled())
+            return None;
+        if (components == 2 || (normalMap && components >= 3))
+            return BC5;
+        if (components == 3 && supportsS3TC())
+            return BC1;
+        if (components == 4 && supportsS3TC())
+            return BC3;
+        return None;
+    }
+
+    // BC5 is core, BC1 and BC3 need the S3TC extension.
+    // the first call has to come from the thread owning the context, the answer is cached for the worker threads
+    static bool supportsS3TC()
+    {
+        static const bool supported = []()
+        {
+            GLint extensionCount = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+            for (GLint i = 0; i < extensionCount; i++)
+            {
+                const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+                if (name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+                    return true;
+            }
+            return false;
+        }();
+        return supported;
+    }
+
+private:
+    struct Level
+    {
+        int width, height;
+        size_t offset; // first byte of the first face
+        size_t size;   // bytes of each face
+        size_t stride; // bytes from one face to the next
+    };
+
+    GLenum type, format, internalFormat;
+    int width, height, faceCount;
+    std::vector<Level> levels;
+
+    // the file contents, either built in memory or mapped
+    std::vector<unsigned char> storage;
+    MappedFile mapping;
+
+    static std::string& cacheDirectory()
+    {
+        static std::string directory("texture_cache");
+        return directory;
+    }
+
+    static bool& compressionSetting()
+    {
+        static bool enabled = true;
+        return enabled;
+    }
+
+    static void createDirectory(const std::string &directory)
+    {
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+    }
+
+    const unsigned char* bytes() const { return mapping.data() ? mapping.data() : storage.data(); }
+    size_t byteCount() const { return mapping.data() ? mapping.size() : storage.size(); }
+
+    static const unsigned char* fileIdentifier()
+    {
+        static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        return identifier;
+    }
+
+    // reads the header and locates the levels
+    bool parse(const unsigned char *data, size_t size)
+    {
+        if (size < 64 || std::memcmp(data, fileIdentifier(), 12) != 0)
+            return false;
+
+        uint32_t header[13];
+        std::memcpy(header, data + 12, sizeof(header));
+        // written on a machine with different endianness, or not a 2D texture
+        if (header[0] != 0x04030201 || header[8] != 0 || header[9] != 0 || (header[10] != 1 && header[10] != 6) || header[11] == 0)
+            return false;
+
+        type = header[1];
+        format = header[3];
+        internalFormat = header[4];
+        width = (int)header[6];
+        height = (int)header[7];
+        faceCount = (int)header[10];
+
+        bool s3tc = internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ||
+                    internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT || internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        if (s3tc && !supportsS3TC())
+            return false;
+
+        size_t offset = 64 + header[12];
+        levels.clear();
+        for (uint32_t level = 0; level < header[11]; level++)
+        {
+            if (offset + 4 > size)
+                return false;
+            uint32_t imageSize;
+            std::memcpy(&imageSize, data + offset, sizeof(imageSize));
+            offset += 4;
+
+            Level mip;
+            mip.width = std::max(1, width >> level);
+            mip.height = std::max(1, height >> level);
+            mip.offset = offset;
+            mip.size = imageSize;
+            mip.stride = (imageSize + 3) & ~(size_t)3;
+            levels.push_back(mip);
+
+            offset = (offset + mip.stride * faceCount + 3) & ~(size_t)3;
+            if (offset > size)
+                return false;
+        }
+        return true;
+    }
+
+    static void appendBytes(std::vector<unsigned char> &bytes, const void *data, size_t size)
+    {
+        const unsigned char *first = (const unsigned char*)data;
+        bytes.insert(bytes.end(), first, first + size);
+    }
+
+    static GLenum baseFormat(int components)
+    {
+        const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        return formats[components - 1];
+    }
+
+    static GLenum sizedFormat(int components, bool srgb, Compression compression)
+    {
+        switch (compression)
+        {
+        case BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BC5: return GL_COMPRESSED_RG_RGTC2;
+        default: break;
+        }
+        const GLenum formats[] = { GL_R8, GL_RG8, (GLenum)(srgb ? GL_SRGB8 : GL_RGB8), (GLenum)(srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8) };
+        return formats[components - 1];
+    }
+
+    // bytes of one face of a level
+    static size_t levelSize(int levelWidth, int levelHeight, int components, Compression compression)
+    {
+        if (compression == None)
+            return paddedRowSize(levelWidth, components) * levelHeight;
+        size_t blockCount = (size_t)((levelWidth + 3) / 4) * ((levelHeight + 3) / 4);
+        return blockCount * (compression == BC1 ? 8 : 16);
+    }
+
+    static size_t paddedRowSize(int rowWidth, int components)
+    {
+        return ((size_t)rowWidth * components + 3) & ~(size_t)3;
+    }
+
+    static void appendRows(std::vector<unsigned char> &bytes, const std::vector<unsigned char> &pixels, int levelWidth, int levelHeight, int components)
+    {
+        size_t rowSize = (size_t)levelWidth * components;
+        size_t padding = paddedRowSize(levelWidth, components) - rowSize;
+        for (int y = 0; y < levelHeight; y++)
+        {
+            bytes.insert(bytes.end(), pixels.begin() + y * rowSize, pixels.begin() + (y + 1) * rowSize);
+            bytes.insert(bytes.end(), padding, 0);
+        }
+    }
+
+    // 2x2 box filter. sRGB colors are averaged in linear space
+    static std::vector<unsigned char> downsample(const std::vector<unsigned char> &pixels, int levelWidth, int levelHeight, int components, bool srgb)
+    {
+        int halfWidth = std::max(1, levelWidth / 2), halfHeight = std::max(1, levelHeight / 2);
+        std::vector<unsigned char> half((size_t)halfWidth * halfHeight * components);
+        for (int y = 0; y < halfHeight; y++)
+        {
+            int y0 = std::min(2 * y, levelHeight - 1), y1 = std::min(2 * y + 1, levelHeight - 1);
+            for (int x = 0; x < halfWidth; x++)
+            {
+                int x0 = std::min(2 * x, levelWidth - 1), x1 = std::min(2 * x + 1, levelWidth - 1);
+                for (int c = 0; c < components; c++)
+                {
+                    unsigned char texels[4] = {
+                        pixels[((size_t)y0 * levelWidth + x0) * components + c], pixels[((size_t)y0 * levelWidth + x1) * components + c],
+                        pixels[((size_t)y1 * levelWidth + x0) * components + c], pixels[((size_t)y1 * levelWidth + x1) * components + c]
+                    };
+                    unsigned char &result = half[((size_t)y * halfWidth + x) * components + c];
+                    if (srgb && c < 3)
+                    {
+                        float sum = srgbToLinear(texels[0]) + srgbToLinear(texels[1]) + srgbToLinear(texels[2]) + srgbToLinear(texels[3]);
+                        result = linearToSrgb(sum * 0.25f);
+                    }
+                    else
+                        result = (unsigned char)((texels[0] + texels[1] + texels[2] + texels[3] + 2) / 4);
+                }
+            }
+        }
+        return half;
+    }
+
+    static float srgbToLinear(unsigned char value)
+    {
+        static const std::vector<float> table = []()
+        {
+            std::vector<float> values(256);
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return values;
+        }();
+        return table[value];
+    }
+
+    static unsigned char linearToSrgb(float value)
+    {
+        float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+        return (unsigned char)(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    static void appendBlocks(std::vector<unsigned char> &bytes, const std::vector<unsigned char> &pixels, int levelWidth, int levelHeight, int components, Compression compression)
+    {
+        for (int blockY = 0; blockY < levelHeight; blockY += 4)
+        {
+            for (int blockX = 0; blockX < levelWidth; blockX += 4)
+            {
+                // gather the 4x4 texels as RGBA, repeating the last row/column for blocks that stick out of small levels
+                unsigned char rgba[16][4];
+                for (int i = 0; i < 16; i++)
+                {
+                    int x = std::min(blockX + i % 4, levelWidth - 1), y = std::min(blockY + i / 4, levelHeight - 1);
+                    const unsigned char *texel = &pixels[((size_t)y * levelWidth + x) * components];
+                    rgba[i][0] = texel[0];
+                    rgba[i][1] = components > 1 ? texel[1] : texel[0];
+                    rgba[i][2] = components > 2 ? texel[2] : components == 1 ? texel[0] : 0;
+                    rgba[i][3] = components > 3 ? texel[3] : 255;
+                }
+
+                unsigned char block[16];
+                unsigned char channel[16];
+                if (compression == BC1)
+                    encodeBC1(rgba, block);
+                else if (compression == BC3)
+                {
+                    for (int i = 0; i < 16; i++)
+                        channel[i] = rgba[i][3];
+                    encodeBC4(channel, block);
+                    encodeBC1(rgba, block + 8);
+                }
+                else
+                {
+                    for (int i = 0; i < 16; i++)
+                        channel[i] = rgba[i][0];
+                    encodeBC4(channel, block);
+                    for (int i = 0; i < 16; i++)
+                        channel[i] = rgba[i][1];
+                    encodeBC4(channel, block + 8);
+                }
+                bytes.insert(bytes.end(), block, block + (compression == BC1 ? 8 : 16));
+            }
+        }
+    }
+
+    // two RGB565 endpoints and a 2 bit index per texel choosing among them and the two colors in between
+    static void encodeBC1(const unsigned char rgba[16][4], unsigned char *block)
+    {
+        // endpoints on the corners of the colors' bounding box, along the diagonal that follows how the colors vary
+        int minColor[3] = { 255, 255, 255 }, maxColor[3] = { 0, 0, 0 };
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                minColor[c] = std::min(minColor[c], (int)rgba[i][c]);
+                maxColor[c] = std::max(maxColor[c], (int)rgba[i][c]);
+                mean[c] += rgba[i][c] / 16.0f;
+            }
+        }
+        float covarianceRG = 0.0f, covarianceRB = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            covarianceRG += (rgba[i][0] - mean[0]) * (rgba[i][1] - mean[1]);
+            covarianceRB += (rgba[i][0] - mean[0]) * (rgba[i][2] - mean[2]);
+        }
+        if (covarianceRG < 0.0f)
+            std::swap(minColor[1], maxColor[1]);
+        if (covarianceRB < 0.0f)
+            std::swap(minColor[2], maxColor[2]);
+
+        // pull the endpoints slightly inwards, so that outliers don't stretch the palette
+        for (int c = 0; c < 3; c++)
+        {
+            int inset = (maxColor[c] - minColor[c]) / 16;
+            maxColor[c] -= inset;
+            minColor[c] += inset;
+        }
+
+        // the first endpoint has to be the larger one, smaller means the 3 color mode with transparency
+        unsigned short color0 = packRGB565(maxColor), color1 = packRGB565(minColor);
+        if (color0 < color1)
+            std::swap(color0, color1);
+
+        // palette as the GPU expands it
+        int palette[4][3];
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        uint32_t indices = 0;
+        if (color0 != color1)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestDistance = INT32_MAX;
+                for (int p = 0; p < 4; p++)
+                {
+                    int dr = rgba[i][0] - palette[p][0], dg = rgba[i][1] - palette[p][1], db = rgba[i][2] - palette[p][2];
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < bestDistance)
+                    {
+                        best = p;
+                        bestDistance = distance;
+                    }
+                }
+                indices |= (uint32_t)best << (2 * i);
+            }
+        }
+
+        block[0] = color0 & 0xFF;
+        block[1] = color0 >> 8;
+        block[2] = color1 & 0xFF;
+        block[3] = color1 >> 8;
+        for (int b = 0; b < 4; b++)
+            block[4 + b] = (indices >> (8 * b)) & 0xFF;
+    }
+
+    // two 8 bit endpoints and a 3 bit index per texel choosing among them and the six values in between
+    static void encodeBC4(const unsigned char values[16], unsigned char *block)
+    {
+        int maxValue = 0, minValue = 255;
+        for (int i = 0; i < 16; i++)
+        {
+            maxValue = std::max(maxValue, (int)values[i]);
+            minValue = std::min(minValue, (int)values[i]);
+        }
+
+        // the larger endpoint first selects the 8 value mode
+        int palette[8] = { maxValue, minValue };
+        for (int i = 1; i <= 6; i++)
+            palette[i + 1] = ((7 - i) * maxValue + i * minValue) / 7;
+
+        uint64_t indices = 0;
+        if (maxValue != minValue)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestDistance = 256;
+                for (int p = 0; p < 8; p++)
+                {
+                    int distance = std::abs(values[i] - palette[p]);
+                    if (distance < bestDistance)
+                    {
+                        best = p;
+                        bestDistance = distance;
+                    }
+                }
+                indices |= (uint64_t)best << (3 * i);
+            }
+        }
+
+        block[0] = (unsigned char)maxValue;
+        block[1] = (unsigned char)minValue;
+        for (int b = 0; b < 6; b++)
+            block[2 + b] = (indices >> (8 * b)) & 0xFF;
+    }
+
+    static unsigned short packRGB565(const int color[3])
+    {
+        return (unsigned short)((((color[0] * 31 + 127) / 255) << 11) | (((color[1] * 63 + 127) / 255) << 5) | ((color[2] * 31 + 127) / 255));
+    }
+
+    static void unpackRGB565(unsigned short packed, int color[3])
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+};
+#endif
@@ -0,0 +1,433 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// reduces the triangle count of an indexed mesh by collapsing edges, cheapest first, where the cost of a collapse is the
+// quadric error metric (Garland and Heckbert): the squared distance of the new position to the planes of the triangles
+// that were merged into the vertex. vertices are never moved, a vertex collapses onto one of its neighbours, so every
+// level of detail can index the same vertex buffer.
+// vertices that share a position (uv or normal seams) collapse together so the seam doesn't tear, open borders are kept
+class MeshSimplifier
+{
+public:
+    // returns the indices of the simplified mesh. collapses stop once the index count reaches targetIndexCount, or when the
+    // quadric error of the next one would be above targetError. resultError receives the largest distance between the
+    // simplified and the full detail surface, in position units, measured from every original vertex
+    template <typename VertexType>
+    static std::vector<unsigned int> simplify(const std::vector<VertexType> &vertices, const std::vector<unsigned int> &indices,
+                                              size_t targetIndexCount, float targetError, float *resultError = nullptr)
+    {
+        size_t vertexCount = vertices.size();
+        std::vector<unsigned int> result = indices;
+
+        // vertices at the same position form a group, linked in a loop through wedgeNext. wedge is the first of the group
+        std::vector<unsigned int> wedge(vertexCount), wedgeNext(vertexCount);
+        buildWedges(vertices, wedge, wedgeNext);
+
+        // quadrics and locks are kept per group
+        std::vector<Quadric> quadrics(vertexCount);
+        for (size_t i = 0; i + 2 < result.size(); i += 3)
+        {
+            Quadric plane = planeQuadric(vertices[result[i]].Position, vertices[result[i + 1]].Position, vertices[result[i + 2]].Position);
+            for (int k = 0; k < 3; k++)
+                quadrics[wedge[result[i + k]]].add(plane);
+        }
+        std::vector<bool> locked = findLockedVertices(result, wedge);
+
+        std::vector<unsigned int> collapse(vertexCount);
+        std::vector<bool> touched(vertexCount);
+        std::vector<unsigned int> adjacencyOffset, adjacency, partners;
+        std::vector<Collapse> candidates;
+        const float errorLimit = targetError * targetError;
+
+        while (result.size() > targetIndexCount)
+        {
+            buildAdjacency(result, vertexCount, adjacencyOffset, adjacency);
+
+            // both directions of every edge between two groups are candidates
+            candidates.clear();
+            for (size_t i = 0; i < result.size(); i++)
+            {
+                unsigned int from = wedge[result[i]], to = wedge[result[i - i % 3 + (i + 1) % 3]];
+                if (from == to || locked[from])
+                    continue;
+                Quadric merged = quadrics[from];
+                merged.add(quadrics[to]);
+                Collapse candidate = { from, to, merged.error(vertices[to].Position) };
+                candidates.push_back(candidate);
+            }
+            std::sort(candidates.begin(), candidates.end(), [](const Collapse &a, const Collapse &b) { return a.error < b.error; });
+
+            // collapses in one pass don't share triangles, so the flip checks below stay valid while applying them
+            for (size_t v = 0; v < vertexCount; v++)
+                collapse[v] = (unsigned int)v;
+            std::fill(touched.begin(), touched.end(), false);
+            size_t trianglesToRemove = (result.size() - targetIndexCount) / 3, removed = 0;
+            bool progress = false;
+
+            for (size_t c = 0; c < candidates.size() && removed < trianglesToRemove; c++)
+            {
+                const Collapse &candidate = candidates[c];
+                if (candidate.error > errorLimit)
+                    break;
+                if (touched[candidate.from] || touched[candidate.to])
+                    continue;
+                if (!findPartners(candidate, result, wedge, wedgeNext, adjacencyOffset, adjacency, partners))
+                    continue;
+                if (flipsTriangle(candidate, vertices, result, wedge, wedgeNext, adjacencyOffset, adjacency))
+                    continue;
+
+                // apply the collapse, and keep the neighbourhood out of this pass
+                unsigned int w = candidate.from;
+                for (size_t p = 0; p < partners.size(); p++, w = wedgeNext[w])
+                {
+                    collapse[w] = partners[p];
+                    for (unsigned int a = adjacencyOffset[w]; a < adjacencyOffset[w + 1]; a++)
+                    {
+                        const unsigned int *triangle = &result[3 * adjacency[a]];
+                        bool degenerate = false;
+                        for (int k = 0; k < 3; k++)
+                        {
+                            touched[wedge[triangle[k]]] = true;
+                            degenerate = degenerate || wedge[triangle[k]] == candidate.to;
+                        }
+                        removed += degenerate ? 1 : 0;
+                    }
+                }
+                quadrics[candidate.to].add(quadrics[candidate.from]);
+                progress = true;
+            }
+            if (!progress)
+                break;
+
+            // remap the triangles, the ones that lost an edge are dropped
+            size_t write = 0;
+            for (size_t i = 0; i + 2 < result.size(); i += 3)
+            {
+                unsigned int a = collapse[result[i]], b = collapse[result[i + 1]], c = collapse[result[i + 2]];
+                if (wedge[a] == wedge[b] || wedge[b] == wedge[c] || wedge[c] == wedge[a])
+                    continue;
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+            result.resize(write);
+        }
+
+        if (resultError)
+            *resultError = measureError(vertices, indices, result, wedge);
+        return result;
+    }
+
+private:
+    // symmetric 4x4 matrix of the summed plane equations, weighted by triangle area
+    struct Quadric
+    {
+        Quadric() : a00(0), a11(0), a22(0), a01(0), a02(0), a12(0), b0(0), b1(0), b2(0), c(0), weight(0) {}
+
+        double a00, a11, a22, a01, a02, a12, b0, b1, b2, c, weight;
+
+        void add(const Quadric &q)
+        {
+            a00 += q.a00; a11 += q.a11; a22 += q.a22; a01 += q.a01; a02 += q.a02; a12 += q.a12;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; weight += q.weight;
+        }
+
+        // weighted mean of the squared distances from p to the planes
+        float error(const glm::vec3 &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                     + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+            return weight > 0.0 ? (float)std::max(e / weight, 0.0) : 0.0f;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from, to;
+        float error;
+    };
+
+    static Quadric planeQuadric(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2)
+    {
+        Quadric q;
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length == 0.0f)
+            return q;
+        normal /= length;
+        double w = length * 0.5, d = -glm::dot(normal, p0);
+        q.a00 = w * normal.x * normal.x; q.a11 = w * normal.y * normal.y; q.a22 = w * normal.z * normal.z;
+        q.a01 = w * normal.x * normal.y; q.a02 = w * normal.x * normal.z; q.a12 = w * normal.y * normal.z;
+        q.b0 = w * normal.x * d; q.b1 = w * normal.y * d; q.b2 = w * normal.z * d;
+        q.c = w * d * d;
+        q.weight = w;
+        return q;
+    }
+
+    template <typename VertexType>
+    static void buildWedges(const std::vector<VertexType> &vertices, std::vector<unsigned int> &wedge, std::vector<unsigned int> &wedgeNext)
+    {
+        std::vector<unsigned int> order(vertices.size());
+        for (size_t v = 0; v < order.size(); v++)
+            order[v] = (unsigned int)v;
+        auto less = [&vertices](unsigned int a, unsigned int b)
+        {
+            const glm::vec3 &pa = vertices[a].Position, &pb = vertices[b].Position;
+            return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+        };
+        std::sort(order.begin(), order.end(), less);
+
+        for (size_t begin = 0, end = 0; begin < order.size(); begin = end)
+        {
+            for (end = begin + 1; end < order.size() && vertices[order[end]].Position == vertices[order[begin]].Position; end++)
+                ;
+            for (size_t i = begin; i < end; i++)
+            {
+                wedge[order[i]] = order[begin];
+                wedgeNext[order[i]] = order[i + 1 < end ? i + 1 : begin];
+            }
+        }
+    }
+
+    // groups on an open border or a non-manifold edge: these edges don't have exactly two triangles
+    static std::vector<bool> findLockedVertices(const std::vector<unsigned int> &indices, const std::vector<unsigned int> &wedge)
+    {
+        std::vector<uint64_t> edges;
+        edges.reserve(indices.size());
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            uint64_t a = wedge[indices[i]], b = wedge[indices[i - i % 3 + (i + 1) % 3]];
+            edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+        }
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<bool> locked(wedge.size(), false);
+        for (size_t begin = 0, end = 0; begin < edges.size(); begin = end)
+        {
+            for (end = begin + 1; end < edges.size() && edges[end] == edges[begin]; end++)
+                ;
+            if (end - begin != 2)
+                locked[(size_t)(edges[begin] >> 32)] = locked[(size_t)(edges[begin] & 0xffffffffu)] = true;
+        }
+        return locked;
+    }
+
+    static void buildAdjacency(const std::vector<unsigned int> &indices, size_t vertexCount, std::vector<unsigned int> &offset, std::vector<unsigned int> &adjacency)
+    {
+        offset.assign(vertexCount + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++)
+            offset[indices[i] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offset[v + 1] += offset[v];
+        adjacency.resize(indices.size());
+        std::vector<unsigned int> fill(offset.begin(), offset.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+    }
+
+    // every vertex of the 'from' group needs a vertex of the 'to' group that it shares a triangle with, that's where its
+    // attributes go. without one, the collapse would open a crack along a seam
+    static bool findPartners(const Collapse &candidate, const std::vector<unsigned int> &indices, const std::vector<unsigned int> &wedge,
+                             const std::vector<unsigned int> &wedgeNext, const std::vector<unsigned int> &offset,
+                             const std::vector<unsigned int> &adjacency, std::vector<unsigned int> &partners)
+    {
+        partners.clear();
+        unsigned int w = candidate.from;
+        do
+        {
+            unsigned int partner = ~0u;
+            for (unsigned int a = offset[w]; a < offset[w + 1] && partner == ~0u; a++)
+                for (int k = 0; k < 3; k++)
+                    if (wedge[indices[3 * adjacency[a] + k]] == candidate.to)
+                        partner = indices[3 * adjacency[a] + k];
+            // vertices without triangles left don't need one
+            if (partner == ~0u && offset[w + 1] > offset[w])
+                return false;
+            partners.push_back(partner == ~0u ? w : partner);
+            w = wedgeNext[w];
+        } while (w != candidate.from);
+        return true;
+    }
+
+    // true if moving the 'from' group onto the 'to' position turns any remaining triangle around
+    template <typename VertexType>
+    static bool flipsTriangle(const Collapse &candidate, const std::vector<VertexType> &vertices, const std::vector<unsigned int> &indices,
+                              const std::vector<unsigned int> &wedge, const std::vector<unsigned int> &wedgeNext,
+                              const std::vector<unsigned int> &offset, const std::vector<unsigned int> &adjacency)
+    {
+        const glm::vec3 &target = vertices[candidate.to].Position;
+        unsigned int w = candidate.from;
+        do
+        {
+            for (unsigned int a = offset[w]; a < offset[w + 1]; a++)
+            {
+                const unsigned int *triangle = &indices[3 * adjacency[a]];
+                glm::vec3 before[3], after[3];
+                bool collapses = false;
+                for (int k = 0; k < 3; k++)
+                {
+                    collapses = collapses || wedge[triangle[k]] == candidate.to;
+                    before[k] = vertices[triangle[k]].Position;
+                    after[k] = wedge[triangle[k]] == candidate.from ? target : before[k];
+                }
+                if (collapses)
+                    continue;
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+                    return true;
+            }
+            w = wedgeNext[w];
+        } while (w != candidate.from);
+        return false;
+    }
+
+    // the largest distance from a vertex of the original mesh to the simplified triangles. the quadric error is a weighted
+    // mean over the merged planes, so it can't bound this. the triangles are put in a uniform grid, and the cells around
+    // each vertex are searched in growing rings until no unsearched cell can be closer than the nearest triangle found
+    template <typename VertexType>
+    static float measureError(const std::vector<VertexType> &vertices, const std::vector<unsigned int> &indices,
+                              const std::vector<unsigned int> &simplified, const std::vector<unsigned int> &wedge)
+    {
+        size_t triangleCount = simplified.size() / 3;
+        if (triangleCount == 0)
+            return indices.empty() ? 0.0f : FLT_MAX;
+
+        // the grid covers all the original vertices, cells are about twice as wide as an average simplified triangle
+        glm::vec3 minPosition(FLT_MAX), maxPosition(-FLT_MAX);
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            minPosition = glm::min(minPosition, vertices[indices[i]].Position);
+            maxPosition = glm::max(maxPosition, vertices[indices[i]].Position);
+        }
+        float area = 0.0f;
+        for (size_t i = 0; i < simplified.size(); i += 3)
+        {
+            const glm::vec3 &p0 = vertices[simplified[i]].Position;
+            area += glm::length(glm::cross(vertices[simplified[i + 1]].Position - p0, vertices[simplified[i + 2]].Position - p0)) * 0.5f;
+        }
+        glm::vec3 extent = maxPosition - minPosition;
+        float cellSize = std::max(2.0f * std::sqrt(area / triangleCount), std::max(extent.x, std::max(extent.y, extent.z)) / 128.0f);
+        if (cellSize <= 0.0f)
+            return 0.0f;
+        glm::ivec3 cells = glm::ivec3(extent / cellSize) + 1;
+
+        // triangles of every cell their box overlaps, one cell after the other
+        auto cellOf = [&](const glm::vec3 &p)
+        {
+            return glm::clamp(glm::ivec3((p - minPosition) / cellSize), glm::ivec3(0), cells - 1);
+        };
+        std::vector<unsigned int> cellOffset((size_t)cells.x * cells.y * cells.z + 1, 0), cellTriangles;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (size_t t = 0; t < triangleCount; t++)
+            {
+                const glm::vec3 &p0 = vertices[simplified[3 * t]].Position, &p1 = vertices[simplified[3 * t + 1]].Position,
+                                &p2 = vertices[simplified[3 * t + 2]].Position;
+                glm::ivec3 first = cellOf(glm::min(p0, glm::min(p1, p2))), last = cellOf(glm::max(p0, glm::max(p1, p2)));
+                for (int z = first.z; z <= last.z; z++)
+                    for (int y = first.y; y <= last.y; y++)
+                        for (int x = first.x; x <= last.x; x++)
+                        {
+                            size_t cell = ((size_t)z * cells.y + y) * cells.x + x;
+                            if (pass == 0)
+                                cellOffset[cell + 1]++;
+                            else
+                                cellTriangles[cellOffset[cell]++] = (unsigned int)t;
+                        }
+            }
+            if (pass == 0)
+            {
+                for (size_t c = 1; c < cellOffset.size(); c++)
+                    cellOffset[c] += cellOffset[c - 1];
+                cellTriangles.resize(cellOffset.back());
+            }
+        }
+        // the second pass moved every offset to the end of its cell
+        for (size_t c = cellOffset.size() - 1; c > 0; c--)
+            cellOffset[c] = cellOffset[c - 1];
+        cellOffset[0] = 0;
+
+        // vertices that share a position are measured once
+        std::vector<bool> measured(vertices.size(), false);
+        float maxDistance = 0.0f;
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            unsigned int v = wedge[indices[i]];
+            if (measured[v])
+                continue;
+            measured[v] = true;
+
+            const glm::vec3 &p = vertices[v].Position;
+            glm::ivec3 center = cellOf(p);
+            int maxRing = std::max(cells.x, std::max(cells.y, cells.z));
+            float nearest = FLT_MAX;
+            // the vertex is inside its cell, so the cells of ring r are at least r - 1 cells away
+            for (int ring = 0; ring < maxRing && nearest > (ring - 1) * cellSize; ring++)
+            {
+                glm::ivec3 first = glm::max(center - ring, glm::ivec3(0)), last = glm::min(center + ring, cells - 1);
+                for (int z = first.z; z <= last.z; z++)
+                    for (int y = first.y; y <= last.y; y++)
+                        for (int x = first.x; x <= last.x; x++)
+                        {
+                            glm::ivec3 offset = glm::abs(glm::ivec3(x, y, z) - center);
+                            if (std::max(offset.x, std::max(offset.y, offset.z)) != ring)
+                                continue;
+                            size_t cell = ((size_t)z * cells.y + y) * cells.x + x;
+                            for (unsigned int c = cellOffset[cell]; c < cellOffset[cell + 1]; c++)
+                            {
+                                const unsigned int *triangle = &simplified[3 * cellTriangles[c]];
+                                nearest = std::min(nearest, distanceToTriangle(p, vertices[triangle[0]].Position, vertices[triangle[1]].Position,
+                                                                               vertices[triangle[2]].Position));
+                            }
+                        }
+            }
+            maxDistance = std::max(maxDistance, nearest);
+        }
+        return maxDistance;
+    }
+
+    // distance from p to the closest point of the triangle, found by the region of the triangle p projects into
+    static float distanceToTriangle(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+    {
+        glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+        float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f)
+            return glm::length(ap);
+
+        glm::vec3 bp = p - b;
+        float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3)
+            return glm::length(bp);
+
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+            return glm::length(ap - ab * (d1 / (d1 - d3)));
+
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6)
+            return glm::length(cp);
+
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+            return glm::length(ap - ac * (d2 / (d2 - d6)));
+
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+            return glm::length(bp - (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+
+        float denominator = 1.0f / (va + vb + vc);
+        return glm::length(ap - ab * (vb * denominator) - ac * (vc * denominator));
+    }
+};
+#endif
@@ -11,6 +11,7 @@
 
 #include <glm/glm.hpp>
 
+#include "frame_arena.h"
 #include "objloader.h"
 
 // Very, VERY simple OBJ loader.
@@ -33,10 +34,13 @@ bool loadOBJ(
 ){
     printf("Loading OBJ file %s...\n", path);
 
-    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    std::vector<float> temp_vertices;
-    std::vector<float> temp_uvs;
-    std::vector<float> temp_normals;
+    // the temporary arrays live in the frame arena. loading happens outside of the frame loop, so the blocks they grew
+    // go back to the heap when the function returns
+    FrameArenaScope scope(true);
+    FrameVector<unsigned int> vertexIndices, uvIndices, normalIndices;
+    FrameVector<float> temp_vertices;
+    FrameVector<float> temp_uvs;
+    FrameVector<float> temp_normals;
 
 
     FILE * file = fopen(path, "r");
@@ -117,6 +121,11 @@ bool loadOBJ(
 
     }
 
+    // the output size is known now, grow the arrays once
+    out_vertices.reserve(out_vertices.size() + vertexIndices.size() * 3);
+    out_uvs.reserve(out_uvs.size() + vertexIndices.size() * 2);
+    out_normals.reserve(out_normals.size() + vertexIndices.size() * 3);
+
     // For each vertex of each triangle
     for( unsigned int i=0; i<vertexIndices.size(); i++ ){
 
@@ -155,10 +164,13 @@ bool loadOBJ(
 ){
     printf("Loading OBJ file %s...\n", path);
 
-    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    std::vector<glm::vec3> temp_vertices;
-    std::vector<glm::vec2> temp_uvs;
-    std::vector<glm::vec3> temp_normals;
+    // the temporary arrays live in the frame arena. loading happens outside of the frame loop, so the blocks they grew
+    // go back to the heap when the function returns
+    FrameArenaScope scope(true);
+    FrameVector<unsigned int> vertexIndices, uvIndices, normalIndices;
+    FrameVector<glm::vec3> temp_vertices;
+    FrameVector<glm::vec2> temp_uvs;
+    FrameVector<glm::vec3> temp_normals;
 
 
     FILE * file = fopen(path, "r");
@@ -233,6 +245,11 @@ bool loadOBJ(
 
     }
 
+    // the output size is known now, grow the arrays once
+    out_vertices.reserve(out_vertices.size() + vertexIndices.size());
+    out_uvs.reserve(out_uvs.size() + vertexIndices.size());
+    out_normals.reserve(out_normals.size() + vertexIndices.size());
+
     // For each vertex of each triangle
     for( unsigned int i=0; i<vertexIndices.size(); i++ ){
 
@@ -0,0 +1,67 @@
+#ifndef BLOOM_MIP_CHAIN_H
+#define BLOOM_MIP_CHAIN_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <render_target_pool.h>
+
+#include <algorithm>
+#include <vector>
+
+// the half, quarter, eighth... resolution targets of the bloom. the bright pass is drawn into the first level, every
+// level is downsampled into the next one, and then they are upsampled back, each one added to the level above it.
+// a level has a quarter of the pixels of the previous one, so the whole chain costs about as much as a third of a pass
+// at the size of the first level, and every level makes the blur wider instead of more expensive.
+// the levels are acquired from the pool for the lifetime of the chain, so it lives for the frame's bloom and compose
+// passes, and follows the size of the screen
+class BloomMipChain
+{
+public:
+    static const int MAX_LEVELS = 6;
+
+    // width and height of the screen, the first level has half of them. a chain of no levels holds no targets
+    BloomMipChain(RenderTargetPool& pool, int width, int height, int levelCount) : pool(pool)
+    {
+        levelCount = std::min(levelCount, MAX_LEVELS);
+        for (int i = 0; i < levelCount; i++)
+        {
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+
+            // no alpha, half the bandwidth of the RGBA16F accumulation buffer
+            levels.push_back(pool.Acquire(width, height, GL_R11F_G11F_B10F));
+
+            if (width == 1 && height == 1)
+                break;
+        }
+    }
+
+    ~BloomMipChain()
+    {
+        for (size_t i = 0; i < levels.size(); i++)
+            pool.Release(levels[i]);
+    }
+
+    // the chain holds targets of the pool, so it can't be copied
+    BloomMipChain(const BloomMipChain&) = delete;
+    BloomMipChain& operator=(const BloomMipChain&) = delete;
+
+    int LevelCount() const { return (int)levels.size(); }
+
+    GLuint Framebuffer(int level) const { return levels[level]->framebuffer; }
+    GLuint Texture(int level) const { return levels[level]->texture; }
+    glm::ivec2 Size(int level) const { return glm::ivec2(levels[level]->width, levels[level]->height); }
+
+    // binds the level's framebuffer, with a viewport of its size
+    void BindLevel(int level) const
+    {
+        levels[level]->Bind();
+    }
+
+private:
+    RenderTargetPool& pool;
+    std::vector<RenderTarget*> levels;
+};
+#endif
@@ -0,0 +1,228 @@
+#ifndef CASCADED_SHADOW_MAP_H
+#define CASCADED_SHADOW_MAP_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "shadow_map_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+
+// the shadow of the directional light, split along the view frustum into cascades that cover more of the scene the
+// further they get from the camera, all in the layers of one depth texture array. every cascade is an orthographic
+// box around a sphere enclosing its slice of the frustum: the sphere only depends on the split depths and the field
+// of view, so the box doesn't change size as the camera turns, and it moves in whole texels so the shadow edges don't
+// shimmer. each layer keeps its own ShadowMapCache, a cascade that didn't move isn't drawn again
+class CascadedShadowMap
+{
+public:
+    static const int MAX_CASCADES = 4;
+
+    // resolution is the width and height of every cascade
+    CascadedShadowMap(GLsizei resolution)
+        : resolution(resolution), texture(0), cascadeCount(0), drawnObjects(0), culledObjects(0)
+    {
+        // the texture binding is put back, it may be cached by the caller
+        GLint boundTexture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &boundTexture);
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, resolution, resolution, MAX_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, (GLuint)boundTexture);
+
+        // a framebuffer for every layer
+        glGenFramebuffers(MAX_CASCADES, framebuffers);
+        for (int i = 0; i < MAX_CASCADES; i++)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, i);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            caches[i] = new ShadowMapCache(framebuffers[i], resolution, resolution);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ~CascadedShadowMap()
+    {
+        for (int i = 0; i < MAX_CASCADES; i++)
+            delete caches[i];
+        glDeleteFramebuffers(MAX_CASCADES, framebuffers);
+        glDeleteTextures(1, &texture);
+    }
+
+    // the shadow map owns GL objects, so it can't be copied
+    CascadedShadowMap(const CascadedShadowMap&) = delete;
+    CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+    // places the cascades for the camera's frustum, from nearPlane to shadowDistance. splitLambda picks the split
+    // scheme: 0 splits the distance evenly, 1 logarithmically, so every cascade is the same factor larger than the
+    // previous one, and the values in between blend the two. lightDirection points towards the light, in world space.
+    // casterDistance is how far in front of a cascade, towards the light, objects still cast shadows into it
+    void Update(const glm::mat4 &view, float fovy, float aspect, float nearPlane, float shadowDistance,
+                const glm::vec3 &lightDirection, int count, float splitLambda, float casterDistance)
+    {
+        cascadeCount = std::max(1, std::min(count, (int)MAX_CASCADES));
+        drawnObjects = culledObjects = 0;
+
+        // the same rotation for all cascades, so they only move along the texel grid of the light
+        glm::vec3 direction = glm::normalize(lightDirection);
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        lightRotation = glm::lookAt(glm::vec3(0.0f), -direction, up);
+
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanHalfFovy = std::tan(fovy * 0.5f);
+        // squared distance of a frustum corner to the view axis, at depth 1
+        float cornerScale = tanHalfFovy * tanHalfFovy * (1.0f + aspect * aspect);
+
+        float splitNear = nearPlane;
+        for (int i = 0; i < cascadeCount; i++)
+        {
+            float t = (float)(i + 1) / cascadeCount;
+            float uniformSplit = nearPlane + (shadowDistance - nearPlane) * t;
+            float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, t);
+            float splitFar = glm::mix(uniformSplit, logSplit, splitLambda);
+
+            // the smallest sphere around the slice has its center on the view axis, at the same distance from the near
+            // and the far corners, unless that is past the far plane
+            float nearCorners = splitNear * splitNear * cornerScale;
+            float farCorners = splitFar * splitFar * cornerScale;
+            float centerDepth = std::min((splitFar * splitFar - splitNear * splitNear + farCorners - nearCorners) / (2.0f * (splitFar - splitNear)), splitFar);
+            float radius = std::sqrt((splitFar - centerDepth) * (splitFar - centerDepth) + farCorners);
+            // rounded up, so float noise doesn't change the size of the texels
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // snap the center to a whole texel of the cascade, in light space
+            glm::vec4 worldCenter = inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f);
+            glm::vec4 lightCenter = lightRotation * worldCenter;
+            float texelSize = 2.0f * radius / resolution;
+            lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+            lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+            Cascade &cascade = cascades[i];
+            cascade.center = glm::vec3(lightCenter.x, lightCenter.y, lightCenter.z);
+            cascade.radius = radius;
+            // the light looks down -z, so the objects closer to it have a smaller distance
+            cascade.nearDistance = -lightCenter.z - radius - casterDistance;
+            cascade.farDistance = -lightCenter.z + radius;
+            cascade.splitDepth = splitFar;
+            // a tenth of a unit, the bias the single shadow map had, in the depth range of the cascade
+            cascade.depthBias = 0.1f / (cascade.farDistance - cascade.nearDistance);
+
+            glm::mat4 projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+                                              cascade.nearDistance, cascade.farDistance);
+            cascade.lightSpaceMatrix = projection * lightRotation;
+
+            splitNear = splitFar;
+        }
+    }
+
+    // whether a bounding sphere, in world space, touches the box of the cascade or is between it and the light
+    bool Contains(int cascade, const glm::vec3 &center, float radius)
+    {
+        const Cascade &c = cascades[cascade];
+        glm::vec4 lightCenter = lightRotation * glm::vec4(center, 1.0f);
+        bool inside = std::abs(lightCenter.x - c.center.x) <= c.radius + radius &&
+                      std::abs(lightCenter.y - c.center.y) <= c.radius + radius &&
+                      -lightCenter.z + radius >= c.nearDistance && -lightCenter.z - radius <= c.farDistance;
+        if (inside)
+            drawnObjects++;
+        else
+            culledObjects++;
+        return inside;
+    }
+
+    // draws the cascade with the shadow program in use, which has the cascade's light space matrix. see ShadowMapCache::Update
+    bool Draw(int cascade, unsigned int staticVersion, unsigned int dynamicVersion,
+              const std::function<void()> &drawStatic, const std::function<void()> &drawDynamic)
+    {
+        return caches[cascade]->Update(cascades[cascade].lightSpaceMatrix, staticVersion, dynamicVersion, drawStatic, drawDynamic);
+    }
+
+    // draws every cascade again on the next Draw
+    void Invalidate()
+    {
+        for (int i = 0; i < MAX_CASCADES; i++)
+            caches[i]->Invalidate();
+    }
+
+    // the cascade uniforms of shaders/lighting.frag, the texture array is bound by the caller.
+    // inverseView transforms from the view space of the lighting pass to world space
+    void SetUniforms(Shader &shader, const glm::mat4 &inverseView) const
+    {
+        static std::string matrixNames[MAX_CASCADES];
+        if (matrixNames[0].empty())
+            for (int i = 0; i < MAX_CASCADES; i++)
+                matrixNames[i] = "cascadeMatrices[" + std::to_string(i) + "]";
+
+        glm::vec4 splits(0.0f), biases(0.0f);
+        for (int i = 0; i < cascadeCount; i++)
+        {
+            shader.setMat4(matrixNames[i], cascades[i].lightSpaceMatrix * inverseView);
+            splits[i] = cascades[i].splitDepth;
+            biases[i] = cascades[i].depthBias;
+        }
+        shader.setInt("cascadeCount", cascadeCount);
+        shader.setVec4("cascadeSplits", splits);
+        shader.setVec4("cascadeBiases", biases);
+    }
+
+    GLuint Texture() const { return texture; }
+    int CascadeCount() const { return cascadeCount; }
+    const glm::mat4& LightSpaceMatrix(int cascade) const { return cascades[cascade].lightSpaceMatrix; }
+    // distance from the camera where the cascade ends
+    float SplitDepth(int cascade) const { return cascades[cascade].splitDepth; }
+
+    // objects drawn into cascades and objects skipped because they were outside, since the last Update
+    unsigned int DrawnObjects() const { return drawnObjects; }
+    unsigned int CulledObjects() const { return culledObjects; }
+
+    // passes of all the cascades, see ShadowMapCache
+    unsigned int StaticDraws() const { return sum(&ShadowMapCache::StaticDraws); }
+    unsigned int DynamicDraws() const { return sum(&ShadowMapCache::DynamicDraws); }
+    unsigned int SkippedUpdates() const { return sum(&ShadowMapCache::SkippedUpdates); }
+
+private:
+    struct Cascade
+    {
+        glm::mat4 lightSpaceMatrix;
+        glm::vec3 center; // snapped, in the space of lightRotation
+        float radius;
+        float nearDistance, farDistance;
+        float splitDepth;
+        float depthBias;
+    };
+
+    GLsizei resolution;
+    GLuint texture;
+    GLuint framebuffers[MAX_CASCADES];
+    ShadowMapCache* caches[MAX_CASCADES];
+
+    glm::mat4 lightRotation;
+    Cascade cascades[MAX_CASCADES];
+    int cascadeCount;
+
+    unsigned int drawnObjects, culledObjects;
+
+    unsigned int sum(unsigned int (ShadowMapCache::*counter)() const) const
+    {
+        unsigned int total = 0;
+        for (int i = 0; i < MAX_CASCADES; i++)
+            total += (caches[i]->*counter)();
+        return total;
+    }
+};
+#endif
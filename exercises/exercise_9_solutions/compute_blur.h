@@ -0,0 +1,87 @@
+#ifndef COMPUTE_BLUR_H
+#define COMPUTE_BLUR_H
+
+#include <glad/glad.h>
+
+#include <render_state.h>
+#include <shader.h>
+
+#include <algorithm>
+#include <cmath>
+
+// gaussian blur in one compute pass instead of a horizontal and a vertical full screen pass with ping-pong
+// framebuffers, see shaders/blur.comp. the weights are computed here for the radius, the texture is read once per
+// tile, and the taps of both directions come from shared memory, so a wide radius mostly costs arithmetic
+class ComputeBlur
+{
+public:
+    // has to match the compute shader
+    static const int MAX_RADIUS = 16;
+
+    ComputeBlur() : program(0), weightsRadius(-1)
+    {
+        program = Shader::createComputeProgram("shaders/blur.comp");
+
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "SourceTexture"), 0);
+        glUseProgram(0);
+        radiusLocation = glGetUniformLocation(program, "radius");
+        weightsLocation = glGetUniformLocation(program, "weights");
+    }
+
+    ~ComputeBlur()
+    {
+        glDeleteProgram(program);
+    }
+
+    // the pass owns GL objects, so it can't be copied
+    ComputeBlur(const ComputeBlur&) = delete;
+    ComputeBlur& operator=(const ComputeBlur&) = delete;
+
+    // blurs source into target, GL_RGBA16F textures of width x height, with radius texels on each side of a pixel
+    void Blur(GLuint source, GLuint target, int width, int height, int radius)
+    {
+        radius = std::max(0, std::min(radius, MAX_RADIUS));
+        if (radius != weightsRadius)
+            computeWeights(radius);
+
+        glUseProgram(program);
+        glUniform1i(radiusLocation, radius);
+        glUniform1fv(weightsLocation, MAX_RADIUS + 1, weights);
+
+        RenderState::instance().bindTexture(0, GL_TEXTURE_2D, source);
+        glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+        glDispatchCompute((GLuint)(width + TILE_SIZE - 1) / TILE_SIZE, (GLuint)(height + TILE_SIZE - 1) / TILE_SIZE, 1);
+
+        // the target is sampled by the passes after this one
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    }
+
+private:
+    static const int TILE_SIZE = 16;
+
+    GLuint program;
+    GLint radiusLocation, weightsLocation;
+
+    float weights[MAX_RADIUS + 1];
+    int weightsRadius;
+
+    // a gaussian whose tails are about 1% of the center at the radius, normalized so both sides and the center add up to 1
+    void computeWeights(int radius)
+    {
+        float sigma = std::max(radius / 3.0f, 0.5f);
+        float sum = 0.0f;
+        for (int i = 0; i <= MAX_RADIUS; i++)
+        {
+            weights[i] = i <= radius ? std::exp(-(float)(i * i) / (2.0f * sigma * sigma)) : 0.0f;
+            sum += i == 0 ? weights[i] : 2.0f * weights[i];
+        }
+        for (int i = 0; i <= MAX_RADIUS; i++)
+            weights[i] /= sum;
+        weightsRadius = radius;
+    }
+};
+#endif
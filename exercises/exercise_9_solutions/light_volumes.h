@@ -0,0 +1,182 @@
+#ifndef LIGHT_VOLUMES_H
+#define LIGHT_VOLUMES_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+// the point lights of the deferred renderer drawn as low-poly spheres, all of them in one instanced draw call.
+// the light parameters are per instance vertex attributes, read by shaders/lighting.vert with INSTANCED_LIGHTS, so
+// there are no uniforms or draw calls per light. the sphere is scaled to enclose the light's radius, it covers fewer
+// pixels than the cube around it
+class LightVolumes
+{
+public:
+    LightVolumes() : vao(0), vertexBuffer(0), indexBuffer(0), instanceBuffer(0), instanceCapacity(0), indexCount(0)
+    {
+        std::vector<glm::vec3> vertices;
+        std::vector<GLuint> indices;
+        createSphere(vertices, indices);
+        indexCount = (GLsizei)indices.size();
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenBuffers(1, &instanceBuffer);
+        glBindVertexArray(vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+
+        // one light per instance
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceLight), (void*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceLight), (void*)sizeof(glm::vec4));
+        glVertexAttribDivisor(2, 1);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    ~LightVolumes()
+    {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+        glDeleteBuffers(1, &instanceBuffer);
+    }
+
+    // the volumes own GL objects, so they can't be copied
+    LightVolumes(const LightVolumes&) = delete;
+    LightVolumes& operator=(const LightVolumes&) = delete;
+
+    // the lights are gathered again every frame, they move with the camera
+    void ClearLights()
+    {
+        lights.clear();
+    }
+
+    // position in view space, and radiance as the light color times its intensity
+    void AddLight(const glm::vec3 &viewPosition, float radius, const glm::vec3 &radiance)
+    {
+        InstanceLight light;
+        light.positionRadius = glm::vec4(viewPosition, radius);
+        light.radiance = glm::vec4(radiance, 0.0f);
+        lights.push_back(light);
+    }
+
+    // draws every light volume with the lighting program and the deferred pass state that are already set
+    void Draw()
+    {
+        if (lights.empty())
+            return;
+
+        // the buffer only grows, and is orphaned when it is written again
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        if (lights.size() > instanceCapacity)
+            instanceCapacity = lights.size();
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(InstanceLight), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, lights.size() * sizeof(InstanceLight), &lights[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindVertexArray(vao);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, (GLsizei)lights.size());
+        glBindVertexArray(0);
+    }
+
+    // lights of the last Draw
+    unsigned int LightCount() const
+    {
+        return (unsigned int)lights.size();
+    }
+
+    unsigned int TriangleCount() const
+    {
+        return (unsigned int)indexCount / 3;
+    }
+
+private:
+    // instance attributes 1 and 2 of the lighting vertex shader
+    struct InstanceLight
+    {
+        glm::vec4 positionRadius;
+        glm::vec4 radiance;
+    };
+
+    GLuint vao, vertexBuffer, indexBuffer, instanceBuffer;
+    size_t instanceCapacity;
+    GLsizei indexCount;
+    std::vector<InstanceLight> lights;
+
+    // an icosahedron with every triangle split in 4, 80 triangles. its faces cut inside the unit sphere, so the
+    // vertices are pushed out until the closest face touches it
+    static void createSphere(std::vector<glm::vec3> &vertices, std::vector<GLuint> &indices)
+    {
+        const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+        const glm::vec3 corners[12] = {
+            glm::vec3(-1,  t,  0), glm::vec3( 1,  t,  0), glm::vec3(-1, -t,  0), glm::vec3( 1, -t,  0),
+            glm::vec3( 0, -1,  t), glm::vec3( 0,  1,  t), glm::vec3( 0, -1, -t), glm::vec3( 0,  1, -t),
+            glm::vec3( t,  0, -1), glm::vec3( t,  0,  1), glm::vec3(-t,  0, -1), glm::vec3(-t,  0,  1)
+        };
+        const GLuint faces[20][3] = {
+            {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+            {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+            {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+            {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}
+        };
+        for (int i = 0; i < 12; i++)
+            vertices.push_back(glm::normalize(corners[i]));
+
+        // the vertex in the middle of every edge, shared by the two triangles of the edge
+        std::map<std::pair<GLuint, GLuint>, GLuint> middles;
+        for (int face = 0; face < 20; face++)
+        {
+            GLuint middle[3];
+            for (int edge = 0; edge < 3; edge++)
+            {
+                GLuint a = faces[face][edge], b = faces[face][(edge + 1) % 3];
+                std::pair<GLuint, GLuint> key(std::min(a, b), std::max(a, b));
+                std::map<std::pair<GLuint, GLuint>, GLuint>::iterator it = middles.find(key);
+                if (it == middles.end())
+                {
+                    it = middles.insert(std::make_pair(key, (GLuint)vertices.size())).first;
+                    vertices.push_back(glm::normalize(vertices[a] + vertices[b]));
+                }
+                middle[edge] = it->second;
+            }
+            const GLuint triangles[4][3] = {
+                {faces[face][0], middle[0], middle[2]}, {faces[face][1], middle[1], middle[0]},
+                {faces[face][2], middle[2], middle[1]}, {middle[0], middle[1], middle[2]}
+            };
+            for (int triangle = 0; triangle < 4; triangle++)
+                indices.insert(indices.end(), triangles[triangle], triangles[triangle] + 3);
+        }
+
+        // counter clockwise seen from outside, the deferred pass draws the back faces
+        float closestFace = 1.0f;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            glm::vec3 a = vertices[indices[i]], b = vertices[indices[i + 1]], c = vertices[indices[i + 2]];
+            glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+            if (glm::dot(normal, a) < 0.0f)
+                std::swap(indices[i + 1], indices[i + 2]);
+            closestFace = std::min(closestFace, std::abs(glm::dot(normal, a)));
+        }
+        for (size_t i = 0; i < vertices.size(); i++)
+            vertices[i] /= closestFace;
+    }
+};
+#endif
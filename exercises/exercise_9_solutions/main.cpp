@@ -2,11 +2,25 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 
+#include <algorithm>
+#include <functional>
+#include <random>
 #include <vector>
 
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "mesh_batch.h"
+#include "render_state.h"
+#include "shader_batch.h"
+#include "shader_permutations.h"
+#include "light_volumes.h"
+#include "tiled_lighting.h"
+#include "cascaded_shadow_map.h"
+#include "shadow_atlas.h"
+#include "render_target_pool.h"
+#include "bloom_mip_chain.h"
+#include "compute_blur.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -25,7 +39,8 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
 
-const unsigned int SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
+const unsigned int SHADOW_RESOLUTION = 2048; // of every cascade
+const unsigned int SHADOW_ATLAS_SIZE = 4096;
 
 // global variables used for rendering
 // -----------------------------------
@@ -33,13 +48,15 @@ Shader* shader = nullptr;
 Shader* shadowMap_shader;
 Shader* skybox_shader;
 Shader* deferred_shader;
-Shader* lighting_shader;
+ShaderPermutations* lighting_shaders; // one program per kind of light, see getLightingShader
 
 // post-fx shaders
 Shader* copy_shader;
 Shader* compose_shader;
 Shader* blur_shader;
 Shader* bloom_shader;
+Shader* bloomDownsample_shader;
+Shader* bloomUpsample_shader;
 Shader* celshading_shader;
 Shader* outline_shader;
 
@@ -51,6 +68,7 @@ Model* carLightModel;
 Model* carWindowsModel;
 Model* carWheelModel;
 Model* floorModel;
+MeshBatch* carBatch; // body, interior and lights of the car, merged in one buffer
 GLuint carBodyTexture;
 GLuint carPaintTexture;
 GLuint carLightTexture;
@@ -67,15 +85,35 @@ glm::mat4 viewProjection;
 unsigned int skyboxVAO; // skybox handle
 unsigned int cubemapTexture; // skybox texture handle
 
-unsigned int shadowMap, shadowMapFBO;
-glm::mat4 lightSpaceMatrix;
+// the shadow of light 1, every cascade is drawn again only when it changed
+CascadedShadowMap* cascadedShadowMap;
+int shadowCascade = -1; // the cascade being drawn, objects outside of it are skipped
+// the shadows of the point lights, in regions of one texture that are drawn again only when they changed
+ShadowAtlas* shadowAtlas;
+glm::vec4 shadowLightBounds = glm::vec4(0.0f); // position and radius of the point light being drawn into the atlas, objects out of its reach are skipped
+
+// incremented when objects are added, removed or moved, the wheels are the only dynamic objects
+unsigned int staticSceneVersion = 0;
+unsigned int dynamicSceneVersion = 0;
+float wheelAngle = 0.0f;
 
 GLuint gBuffer, accumBuffer;
 GLuint gAlbedo, gNormal, gOthers, gAccum, gDepth;
+int gBufferWidth, gBufferHeight;
+
+// the point lights are shaded in screen tiles by a compute shader when GL 4.3 is available
+TiledLighting* tiledLighting = nullptr;
+// otherwise they are drawn as instanced spheres
+LightVolumes* lightVolumes;
+
 
+// the targets of the post-processing passes, acquired for the frame at the current size of the window
+RenderTargetPool* renderTargets = nullptr;
+// or with GL 4.3, the gaussian blur in one compute pass instead of the two fragment passes
+ComputeBlur* computeBlur = nullptr;
 
-GLuint tempBuffers[2] = { 0, 0 };
-GLuint tempTextures[2] = { 0, 0 };
+// texture bindings and fixed function state of the render loop go through here, so unchanged state isn't set again
+RenderState& renderState = RenderState::instance();
 
 // global variables used for control
 // ---------------------------------
@@ -140,12 +178,50 @@ struct Config
     float bloomThreshold = 1.0f;
     float bloomScale = 1.0f;
     float bloomMax = 5.0f;
+    // blur the bright pass through a chain of half resolution targets, every level makes it wider
+    bool mipChainBloom = true;
+    int bloomLevels = 5;
+    // without the mip chain, blur in shared memory with a compute shader, with radius texels on each side
+    bool computeShaderBlur = true;
+    int blurRadius = 8;
 
     // cel-shading
     int celshadingSteps = 5;
     glm::vec3 outlineColor = glm::vec3(0);
     float outlineDistance = 0.01f;
 
+    // draw the car parts that share a material from one merged buffer, with a multi draw per texture set
+    bool mergeCarMeshes = true;
+
+    // skip GL state calls that wouldn't change anything
+    bool cacheRenderState = true;
+
+    // shade the point lights in screen tiles, each with the lights that touch it, instead of a volume per light
+    bool tiledLightCulling = true;
+    // draw the point light volumes as spheres in one instanced draw call, instead of a cube and a draw call per light
+    bool instancedLightVolumes = true;
+    // random point lights added to the two above
+    int extraLightCount = 0;
+
+    // octahedral normals and 8 bit material channels in the g-buffers, see shaders/gbuffer.glsl. only read at startup,
+    // when the g-buffers and the shaders that read or write them are created
+    bool packedGBuffer = true;
+    // block compressed textures, normal maps in BC5. only read at startup, when the textures are converted
+    bool compressTextures = true;
+
+    // keep the shadow map while the light and the objects stay where they are
+    bool cacheShadowMap = true;
+    // cascades up to the shadow distance, split evenly with lambda 0 and logarithmically with lambda 1
+    int cascadeCount = 4;
+    float cascadeSplitLambda = 0.75f;
+    float shadowDistance = 30.0f;
+    // shadows of the point lights that have them, at most this many are drawn again per frame
+    bool pointLightShadows = true;
+    int shadowAtlasUpdates = 4;
+    bool extraLightShadows = false;
+    // radians per second, moving wheels are drawn over a cached shadow map of the rest
+    float wheelSpeed = 0.0f;
+
 } config;
 
 
@@ -160,25 +236,30 @@ enum class PostFXMode
 // function declarations
 // ---------------------
 void initFrameBuffers(GLFWwindow* window);
-void setLightUniforms(Light &light, Camera* viewSpace);
+void deleteFrameBuffers();
+void setLightUniforms(Light &light, Camera* viewSpace, int atlasLight = -1);
 void updateCameraMatrices();
+void updateExtraLights();
 
 void drawCube();
 void drawQuad();
 void drawSkybox();
 void drawShadowMap();
-void drawObjects();
+void drawShadowAtlas();
+void drawObjects(bool drawStatic = true, bool drawDynamic = true);
 void drawGui();
-void drawDeferredLight(Light& light);
+void drawDeferredLight(Light& light, int atlasLight = -1);
 void drawFullscreenPass(const char* sourceTextureName, GLuint sourceTexture);
 
 unsigned int initSkyboxBuffers();
 unsigned int loadCubemap(vector<std::string> faces);
-void createShadowMap();
 
 void prepareGeometryPass();
 void restoreGeometryPass();
 void prepareDeferredPass();
+Shader* getLightingShader(const Light& light, bool atlasShadow = false);
+Shader* getInstancedLightingShader();
+std::vector<std::string> gBufferDefines(std::vector<std::string> defines = std::vector<std::string>());
 void restoreDeferredPass();
 
 
@@ -226,28 +307,44 @@ int main()
 
     // load the shaders
     // ----------------------------------
-    skybox_shader = new Shader("shaders/skybox.vert", "shaders/skybox.frag");
-    shadowMap_shader = new Shader("shaders/shadowmap.vert", "shaders/shadowmap.frag");
-    deferred_shader = new Shader("shaders/deferred_shading.vert", "shaders/deferred_shading.frag");
-    lighting_shader = new Shader("shaders/lighting.vert", "shaders/lighting.frag");
-
-    copy_shader = new Shader("shaders/fullscreen.vert", "shaders/copy.frag");
-    compose_shader = new Shader("shaders/fullscreen.vert", "shaders/compose.frag");
-    blur_shader = new Shader("shaders/fullscreen.vert", "shaders/blur.frag");
-    bloom_shader = new Shader("shaders/fullscreen.vert", "shaders/bloom.frag");
-    celshading_shader = new Shader("shaders/fullscreen.vert", "shaders/celshading.frag");
-    outline_shader = new Shader("shaders/fullscreen.vert", "shaders/outline.frag");
+    // all the programs are compiled at the same time, by the driver or on worker threads
+    ShaderBatch shaderBatch(window);
+    shaderBatch.Add(skybox_shader, "shaders/skybox.vert", "shaders/skybox.frag");
+    shaderBatch.Add(shadowMap_shader, "shaders/shadowmap.vert", "shaders/shadowmap.frag");
+    shaderBatch.Add(deferred_shader, "shaders/deferred_shading.vert", "shaders/deferred_shading.frag", nullptr, gBufferDefines());
+
+    shaderBatch.Add(copy_shader, "shaders/fullscreen.vert", "shaders/copy.frag");
+    shaderBatch.Add(compose_shader, "shaders/fullscreen.vert", "shaders/compose.frag");
+    shaderBatch.Add(blur_shader, "shaders/fullscreen.vert", "shaders/blur.frag");
+    shaderBatch.Add(bloom_shader, "shaders/fullscreen.vert", "shaders/bloom.frag");
+    shaderBatch.Add(bloomDownsample_shader, "shaders/fullscreen.vert", "shaders/dual_filter.frag");
+    shaderBatch.Add(bloomUpsample_shader, "shaders/fullscreen.vert", "shaders/dual_filter.frag", nullptr, { "UPSAMPLE" });
+    shaderBatch.Add(celshading_shader, "shaders/fullscreen.vert", "shaders/celshading.frag");
+    shaderBatch.Add(outline_shader, "shaders/fullscreen.vert", "shaders/outline.frag");
+    shaderBatch.Compile();
+    // the lighting permutations are compiled when a light first needs them
+    lighting_shaders = new ShaderPermutations("shaders/lighting.vert", "shaders/lighting.frag");
 
 
     // load the 3D models
+    // packed vertices halve the vertex fetch bandwidth of the shadow and geometry passes
+    // the buffers and textures stream in over the first frames, at most 4 MB per frame
     // ----------------------------------
-    carBodyModel = new Model("car/Body_LOD0.obj");
-    carPaintModel = new Model("car/Paint_LOD0.obj");
-    carInteriorModel = new Model("car/Interior_LOD0.obj");
-    carLightModel = new Model("car/Light_LOD0.obj");
-    carWindowsModel = new Model("car/Windows_LOD0.obj");
-    carWheelModel = new Model("car/Wheel_LOD0.obj");
-    floorModel = new Model("floor/floor.obj");
+    UploadQueue::instance().setFrameBudget(4 << 20);
+    TextureContainer::setCompression(config.compressTextures);
+    carBodyModel = new Model("car/Body_LOD0.obj", false, VertexFormat::PackedQuantized);
+    carPaintModel = new Model("car/Paint_LOD0.obj", false, VertexFormat::PackedQuantized);
+    carInteriorModel = new Model("car/Interior_LOD0.obj", false, VertexFormat::PackedQuantized);
+    carLightModel = new Model("car/Light_LOD0.obj", false, VertexFormat::PackedQuantized);
+    carWindowsModel = new Model("car/Windows_LOD0.obj", false, VertexFormat::PackedQuantized);
+    carWheelModel = new Model("car/Wheel_LOD0.obj", false, VertexFormat::PackedQuantized);
+    floorModel = new Model("floor/floor.obj", false, VertexFormat::PackedQuantized);
+
+    carBatch = new MeshBatch(VertexFormat::PackedQuantized);
+    carBatch->Add(*carBodyModel);
+    carBatch->Add(*carLightModel);
+    carBatch->Add(*carInteriorModel);
+    carBatch->Build();
 
     // init skybox
     vector<std::string> faces
@@ -262,7 +359,8 @@ int main()
     cubemapTexture = loadCubemap(faces);
     skyboxVAO = initSkyboxBuffers();
 
-    createShadowMap();
+    cascadedShadowMap = new CascadedShadowMap(SHADOW_RESOLUTION);
+    shadowAtlas = new ShadowAtlas(SHADOW_ATLAS_SIZE, 64, 512);
 
     // set up the z-buffer
     // -------------------
@@ -272,6 +370,15 @@ int main()
 
     //set up gbuffers
     initFrameBuffers(window);
+    // the temp buffers of the blur and the levels of the bloom are acquired from the pool every frame, at the size of the
+    // g-buffers then
+    renderTargets = new RenderTargetPool();
+    if (TiledLighting::supportsComputeShaders())
+    {
+        tiledLighting = new TiledLighting(gBufferDefines());
+        computeBlur = new ComputeBlur();
+    }
+    lightVolumes = new LightVolumes();
 
     // Dear IMGUI init
     // ---------------
@@ -292,8 +399,27 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        // upload the next part of the streaming buffers and textures
+        UploadQueue::instance().update();
+
+        // the upload queue binds its textures through the cache, so the shadowed state carries over between frames
+        if (renderState.cachingEnabled() != config.cacheRenderState)
+            renderState.setCaching(config.cacheRenderState);
+        renderState.resetCounters();
+
         processInput(window);
 
+        // the g-buffers follow the size of the window, a minimized window keeps the old ones
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        if (framebufferWidth > 0 && framebufferHeight > 0 && (framebufferWidth != gBufferWidth || framebufferHeight != gBufferHeight))
+        {
+            deleteFrameBuffers();
+            initFrameBuffers(window);
+            // the new textures were bound with plain GL calls, and may reuse the names of the deleted ones
+            renderState.invalidate();
+        }
+
         // Rotate light 2
         if (lightRotationSpeed > 0.0f)
         {
@@ -301,12 +427,25 @@ int main()
             config.lights[1].position = glm::vec3(rotatedLight.x, rotatedLight.y, rotatedLight.z);
         }
 
+        updateExtraLights();
+
+        // Spin the wheels
+        if (config.wheelSpeed != 0.0f)
+        {
+            wheelAngle += config.wheelSpeed * deltaTime;
+            dynamicSceneVersion++;
+        }
+        // the meshes that streamed in this frame change the shadows too, including the ones of the frame the queue drains
+        if (UploadQueue::instance().uploadedLastFrame() > 0)
+            staticSceneVersion++;
+
         updateCameraMatrices();
 
         drawShadowMap();
+        drawShadowAtlas();
 
         // Enable SRGB framebuffer
-        glEnable(GL_FRAMEBUFFER_SRGB);
+        renderState.enable(GL_FRAMEBUFFER_SRGB);
 
         glBindFramebuffer(GL_FRAMEBUFFER, accumBuffer);
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -330,19 +469,68 @@ int main()
 
         // 2. lighting pass: calculate lighting using the gbuffer's content
         {
-            shader = lighting_shader;
-            shader->use();
-
             glBindFramebuffer(GL_FRAMEBUFFER, accumBuffer);
 
-            prepareDeferredPass();
+            // point lights in one compute pass, the tiled lighting reads the g-buffers once for all of them
+            bool tiled = tiledLighting && config.tiledLightCulling;
+            if (tiled)
+            {
+                tiledLighting->ClearLights();
+                for (int i = 0; i < config.lights.size(); ++i)
+                {
+                    const Light& light = config.lights[i];
+                    if (light.radius > 0 && !shadowAtlas->Contains(i))
+                        tiledLighting->AddLight(glm::vec3(view * glm::vec4(light.position, 1.0f)), light.radius, light.color * light.intensity * glm::pi<float>());
+                }
+                tiledLighting->Shade(gAlbedo, gNormal, gOthers, gDepth, gAccum, gBufferWidth, gBufferHeight, projection);
+            }
+
+            // or as spheres, all of them in one instanced draw call
+            bool instanced = !tiled && config.instancedLightVolumes;
+            if (instanced)
+            {
+                lightVolumes->ClearLights();
+                for (int i = 0; i < config.lights.size(); ++i)
+                {
+                    const Light& light = config.lights[i];
+                    if (light.radius > 0 && !shadowAtlas->Contains(i))
+                        lightVolumes->AddLight(glm::vec3(view * glm::vec4(light.position, 1.0f)), light.radius, light.color * light.intensity * glm::pi<float>());
+                }
+                if (lightVolumes->LightCount() > 0)
+                {
+                    shader = getInstancedLightingShader();
+                    shader->use();
+                    prepareDeferredPass();
+                    shader->setMat4("projection", projection);
+
+                    // the back faces are only drawn where the scene is in front of them, so pixels behind the volume
+                    // are rejected before shading. the fragment shader discards the ones in front that are too far
+                    renderState.enable(GL_DEPTH_TEST);
+                    renderState.depthFunc(GL_GEQUAL);
+                    lightVolumes->Draw();
+                    renderState.depthFunc(GL_LESS);
+                    renderState.disable(GL_DEPTH_TEST);
+                }
+            }
 
-            // render lights
+            // render the other light volumes, switching programs only between lights of different kinds.
+            // the point lights with a shadow in the atlas are drawn one at a time
+            shader = nullptr;
             for (int i = 0; i < config.lights.size(); ++i)
             {
                 Light& light = config.lights[i];
-
-                drawDeferredLight(light);
+                bool atlasShadow = light.radius > 0 && shadowAtlas->Contains(i);
+                if ((tiled || instanced) && light.radius > 0 && !atlasShadow)
+                    continue;
+
+                Shader* lightShader = getLightingShader(light, atlasShadow);
+                if (shader != lightShader)
+                {
+                    shader = lightShader;
+                    shader->use();
+                    prepareDeferredPass();
+                }
+                drawDeferredLight(light, atlasShadow ? i : -1);
             }
 
             restoreDeferredPass();
@@ -356,13 +544,63 @@ int main()
         // Final pass, render accumulation buffer
         if (postFXMode == PostFXMode::Realistic)
         {
+            // the targets match the g-buffers they are drawn from
+            int width = gBufferWidth, height = gBufferHeight;
+
+            // the bloom at decreasing resolutions, instead of the gaussian blur. without it the chain holds no levels
+            BloomMipChain bloomChain(*renderTargets, width, height, config.mipChainBloom ? config.bloomLevels : 0);
+            RenderTarget* brightTarget = nullptr;
+            RenderTarget* blurTarget = nullptr;
+
+            GLuint bloomTexture = 0;
+            if (config.mipChainBloom)
+            {
+                // bright pass, into the first level at half resolution
+                shader = bloom_shader;
+                shader->use();
+                bloomChain.BindLevel(0);
+                shader->setFloat("threshold", config.bloomThreshold);
+                shader->setFloat("scale", config.bloomScale);
+                shader->setFloat("maxIntensity", config.bloomMax);
+                drawFullscreenPass("SourceTexture", gAccum);
+
+                // every level downsampled into the next one
+                int levels = bloomChain.LevelCount();
+                shader = bloomDownsample_shader;
+                shader->use();
+                for (int i = 1; i < levels; i++)
+                {
+                    bloomChain.BindLevel(i);
+                    shader->setVec2("halfTexel", glm::vec2(0.5f) / glm::vec2(bloomChain.Size(i - 1)));
+                    drawFullscreenPass("SourceTexture", bloomChain.Texture(i - 1));
+                }
+
+                // and upsampled back, adding every level to the one above it
+                shader = bloomUpsample_shader;
+                shader->use();
+                renderState.enable(GL_BLEND);
+                renderState.blendFunc(GL_ONE, GL_ONE);
+                for (int i = levels - 1; i > 0; i--)
+                {
+                    bloomChain.BindLevel(i - 1);
+                    shader->setVec2("halfTexel", glm::vec2(0.5f) / glm::vec2(bloomChain.Size(i)));
+                    drawFullscreenPass("SourceTexture", bloomChain.Texture(i));
+                }
+                renderState.disable(GL_BLEND);
+
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glViewport(0, 0, width, height);
+                bloomTexture = bloomChain.Texture(0);
+            }
             //TODO 9.4 : Bloom pass
-            if (tempBuffers[0] != 0)
+            else
             {
                 shader = bloom_shader;
                 shader->use();
 
-                glBindFramebuffer(GL_FRAMEBUFFER, tempBuffers[0]);
+                // same format as the accumulation buffer
+                brightTarget = renderTargets->Acquire(width, height, GL_RGBA16F);
+                brightTarget->Bind();
 
                 shader->setFloat("threshold", config.bloomThreshold);
                 shader->setFloat("scale", config.bloomScale);
@@ -370,28 +608,43 @@ int main()
                 drawFullscreenPass("SourceTexture", gAccum);
 
                 glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                bloomTexture = brightTarget->texture;
+            }
+
+            // both directions in one compute pass, from the bright pass into another target, the bright pass is
+            // released as soon as it has been read
+            bool blurInComputeShader = !config.mipChainBloom && computeBlur && config.computeShaderBlur;
+            if (blurInComputeShader)
+            {
+                blurTarget = renderTargets->Acquire(width, height, GL_RGBA16F);
+                computeBlur->Blur(brightTarget->texture, blurTarget->texture, width, height, config.blurRadius);
+                renderTargets->Release(brightTarget);
+                brightTarget = nullptr;
+                bloomTexture = blurTarget->texture;
             }
 
             //TODO 9.3 : Blur passes
-            for (int i = 0; i < 1; ++i)
+            for (int i = 0; i < (config.mipChainBloom || blurInComputeShader ? 0 : 1); ++i)
             {
                 shader = blur_shader;
                 shader->use();
 
-                int width, height;
-                glfwGetFramebufferSize(window, &width, &height);
+                // only needed between the two passes
+                blurTarget = renderTargets->Acquire(width, height, GL_RGBA16F);
 
                 // Horizontal blur pass
-                glBindFramebuffer(GL_FRAMEBUFFER, tempBuffers[1]);
+                blurTarget->Bind();
                 shader->setVec2("blurScale", glm::vec2(1.0f / width, 0.0f));
-                drawFullscreenPass("SourceTexture", tempTextures[0]);
+                drawFullscreenPass("SourceTexture", brightTarget->texture);
 
                 // Vertical blur pass
-                glBindFramebuffer(GL_FRAMEBUFFER, tempBuffers[0]);
+                brightTarget->Bind();
                 shader->setVec2("blurScale", glm::vec2(0, 1.0f / height));
-                drawFullscreenPass("SourceTexture", tempTextures[1]);
+                drawFullscreenPass("SourceTexture", blurTarget->texture);
 
                 glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                renderTargets->Release(blurTarget);
+                blurTarget = nullptr;
             }
 
             //TODO 9.1 : Composition pass
@@ -401,8 +654,7 @@ int main()
                 shader->use();
 
                 //TODO 9.4 : Add tempTextures[0] as GL_TEXTURE1 and pass it as "BloomTexture"
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, tempTextures[0]);
+                renderState.bindTexture(1, GL_TEXTURE_2D, bloomTexture);
                 shader->setInt("BloomTexture", 1);
 
                 //TODO 9.1 : Add the exposure uniform
@@ -416,6 +668,10 @@ int main()
 
                 drawFullscreenPass("SourceTexture", gAccum);
             }
+
+            // the mip chain gives its levels back when it goes out of scope
+            renderTargets->Release(brightTarget);
+            renderTargets->Release(blurTarget);
         }
         else if (postFXMode == PostFXMode::CelShading)
         {
@@ -434,17 +690,14 @@ int main()
                 shader = outline_shader;
                 shader->use();
 
-                int width, height;
-                glfwGetFramebufferSize(window, &width, &height);
-
-                shader->setVec2("scale", glm::vec2(1.0f / width, 1.0f / height));
+                shader->setVec2("scale", glm::vec2(1.0f / gBufferWidth, 1.0f / gBufferHeight));
                 shader->setVec3("outlineColor", config.outlineColor);
                 shader->setFloat("distance", config.outlineDistance);
 
-                glEnable(GL_BLEND);
-                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                renderState.enable(GL_BLEND);
+                renderState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
                 drawFullscreenPass("SourceTexture", gDepth);
-                glDisable(GL_BLEND);
+                renderState.disable(GL_BLEND);
             }
         }
         else
@@ -456,7 +709,10 @@ int main()
         }
 
         // Disable SRGB framebuffer
-        glDisable(GL_FRAMEBUFFER_SRGB);
+        renderState.disable(GL_FRAMEBUFFER_SRGB);
+
+        // targets that no pass acquired for a few frames, like the ones of the old size after a resize, are deleted
+        renderTargets->EndFrame();
 
         if (isPaused) {
             drawGui();
@@ -479,15 +735,25 @@ int main()
     delete carWindowsModel;
     delete carWheelModel;
     delete floorModel;
+    delete carBatch;
 
     delete deferred_shader;
-    delete lighting_shader;
+    delete lighting_shaders;
+    delete tiledLighting;
+    delete lightVolumes;
     delete skybox_shader;
     delete shadowMap_shader;
+    delete cascadedShadowMap;
+    delete shadowAtlas;
 
     delete copy_shader;
     delete compose_shader;
     delete bloom_shader;
+    delete bloomDownsample_shader;
+    delete bloomUpsample_shader;
+    delete renderTargets;
+    deleteFrameBuffers();
+    delete computeBlur;
     delete blur_shader;
     delete celshading_shader;
     delete outline_shader;
@@ -520,13 +786,40 @@ void drawGui(){
         ImGui::ColorEdit3("light 2 color", (float*)&config.lights[1].color);
         ImGui::SliderFloat("light 2 intensity", &config.lights[1].intensity, 0.0f, 5.0f);
         ImGui::SliderFloat("light 2 radius", &config.lights[1].radius, 0.01f, 50.0f);
+        ImGui::Checkbox("light 2 shadow", &config.lights[1].shadow);
         ImGui::SliderFloat("light 2 speed", &lightRotationSpeed, 0.0f, 2.0f);
+        ImGui::SliderInt("extra point lights", &config.extraLightCount, 0, 4096);
+        if (tiledLighting)
+        {
+            ImGui::Checkbox("tiled light culling", &config.tiledLightCulling);
+            // those tiles drop the lights past the limit
+            if (config.tiledLightCulling && tiledLighting->OverflowTiles() > 0)
+                ImGui::Text("%u tiles over %d lights", tiledLighting->OverflowTiles(), TiledLighting::MAX_TILE_LIGHTS);
+        }
+        ImGui::Checkbox("instanced light volumes", &config.instancedLightVolumes);
+        if (config.instancedLightVolumes)
+            ImGui::Text("%u spheres of %u triangles in one draw call", lightVolumes->LightCount(), lightVolumes->TriangleCount());
         ImGui::Separator();
 
         ImGui::Text("Car paint material: ");
         ImGui::ColorEdit3("color", (float*)&config.reflectionColor);
         ImGui::SliderFloat("roughness", &config.roughness, 0.01f, 1.0f);
         ImGui::SliderFloat("metalness", &config.metalness, 0.0f, 1.0f);
+        ImGui::Checkbox("merge car meshes", &config.mergeCarMeshes);
+        ImGui::Text("%u car meshes, %u texture sets", carBatch->DrawCount(), carBatch->GroupCount());
+        ImGui::Separator();
+
+        ImGui::SliderFloat("wheel speed", &config.wheelSpeed, -10.0f, 10.0f);
+        ImGui::Checkbox("cache shadow map", &config.cacheShadowMap);
+        ImGui::Text("shadow map: %u static, %u dynamic passes, %u skipped", cascadedShadowMap->StaticDraws(), cascadedShadowMap->DynamicDraws(), cascadedShadowMap->SkippedUpdates());
+        ImGui::SliderInt("shadow cascades", &config.cascadeCount, 1, CascadedShadowMap::MAX_CASCADES);
+        ImGui::SliderFloat("cascade split lambda", &config.cascadeSplitLambda, 0.0f, 1.0f);
+        ImGui::SliderFloat("shadow distance", &config.shadowDistance, 5.0f, 100.0f);
+        ImGui::Text("%u objects drawn in the cascades, %u culled", cascadedShadowMap->DrawnObjects(), cascadedShadowMap->CulledObjects());
+        ImGui::Checkbox("point light shadows", &config.pointLightShadows);
+        ImGui::Checkbox("extra light shadows", &config.extraLightShadows);
+        ImGui::SliderInt("shadow updates per frame", &config.shadowAtlasUpdates, 1, 32);
+        ImGui::Text("shadow atlas: %u lights, %.0f%% used, %u lights and %u faces drawn", shadowAtlas->LightCount(), shadowAtlas->Usage() * 100.0f, shadowAtlas->UpdatedLights(), shadowAtlas->DrawnFaces());
         ImGui::Separator();
 
         ImGui::Text("Post-processing: ");
@@ -541,6 +834,16 @@ void drawGui(){
         ImGui::SliderFloat("bloom threshold", &config.bloomThreshold, 0.0f, 10.0f);
         ImGui::SliderFloat("bloom scale", &config.bloomScale, 0.0f, 2.0f);
         ImGui::SliderFloat("bloom max intensity", &config.bloomMax, 0.0f, 10.0f);
+        ImGui::Checkbox("mip chain bloom", &config.mipChainBloom);
+        if (config.mipChainBloom)
+            ImGui::SliderInt("bloom levels", &config.bloomLevels, 1, BloomMipChain::MAX_LEVELS);
+        else if (computeBlur)
+        {
+            ImGui::Checkbox("compute shader blur", &config.computeShaderBlur);
+            if (config.computeShaderBlur)
+                ImGui::SliderInt("blur radius", &config.blurRadius, 1, ComputeBlur::MAX_RADIUS);
+        }
+        ImGui::Text("render targets: %u, %.1f MB, %u acquired last frame", renderTargets->TargetCount(), renderTargets->MemoryBytes() / (1024.0f * 1024.0f), renderTargets->AcquiredLastFrame());
         ImGui::Separator();
         ImGui::SliderInt("cel-shading steps", &config.celshadingSteps, 1, 10);
         ImGui::ColorEdit3("outline color", (float*)&config.outlineColor);
@@ -555,6 +858,11 @@ void drawGui(){
         }
 
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+        ImGui::Text("Streaming %.1f MB left", UploadQueue::instance().pendingBytes() / (1024.0f * 1024.0f));
+        ImGui::Checkbox("cache render state", &config.cacheRenderState);
+        ImGui::Text("GL state calls: %u issued, %u skipped", renderState.issuedCalls(), renderState.skippedCalls());
+        ImGui::Text("%u lighting shader permutations", lighting_shaders->Count());
+        ImGui::Text("%s g-buffer, %d bytes per pixel", config.packedGBuffer ? "packed" : "wide", config.packedGBuffer ? 9 : 12);
         ImGui::End();
     }
 
@@ -569,8 +877,7 @@ void prepareGeometryPass()
 
     // set up skybox texture
     shader->setInt("skybox", 5);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    renderState.bindTexture(5, GL_TEXTURE_CUBE_MAP, cubemapTexture);
 
     shader->setMat4("view", view);
     shader->setMat4("viewProjection", viewProjection);
@@ -579,23 +886,19 @@ void prepareGeometryPass()
 
 void restoreGeometryPass()
 {
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    renderState.bindTexture(5, GL_TEXTURE_CUBE_MAP, 0);
 }
 
 void prepareDeferredPass()
 {
     // Bind g-buffers as textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gAlbedo);
+    renderState.bindTexture(0, GL_TEXTURE_2D, gAlbedo);
     shader->setInt("AlbedoGBuffer", 0);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, gNormal);
+    renderState.bindTexture(1, GL_TEXTURE_2D, gNormal);
     shader->setInt("NormalGBuffer", 1);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, gOthers);
+    renderState.bindTexture(2, GL_TEXTURE_2D, gOthers);
     shader->setInt("OthersGBuffer", 2);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, gDepth);
+    renderState.bindTexture(3, GL_TEXTURE_2D, gDepth);
     shader->setInt("DepthBuffer", 3);
 
     // Set view projection for all lights
@@ -604,38 +907,67 @@ void prepareDeferredPass()
     shader->setMat4("invProjection", glm::inverse(projection));
 
     // Render additional lights in additive
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE);
+    renderState.enable(GL_BLEND);
+    renderState.blendFunc(GL_ONE, GL_ONE);
 
     // Depth clamp ignores clipping with near and far planes
-    glEnable(GL_DEPTH_CLAMP);
+    renderState.enable(GL_DEPTH_CLAMP);
 
     // Render only the back faces of the box
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    renderState.enable(GL_CULL_FACE);
+    renderState.cullFace(GL_FRONT);
 
     // Disable depth write
-    glDepthMask(false);
+    renderState.depthMask(false);
 
     // Disable depth test
-    glDisable(GL_DEPTH_TEST);
+    renderState.disable(GL_DEPTH_TEST);
+}
+
+// the lighting shader specialized for the light, point lights have shadows when they have a region in the shadow atlas
+Shader* getLightingShader(const Light& light, bool atlasShadow)
+{
+    static const vector<std::string> pointLight = gBufferDefines();
+    static const vector<std::string> shadowedPointLight = gBufferDefines({ "SHADOWS" });
+    static const vector<std::string> directionalLight = gBufferDefines({ "DIRECTIONAL_LIGHT" });
+    static const vector<std::string> shadowedDirectionalLight = gBufferDefines({ "DIRECTIONAL_LIGHT", "SHADOWS" });
+
+    if (light.radius > 0)
+        return lighting_shaders->Get(atlasShadow ? shadowedPointLight : pointLight);
+    return lighting_shaders->Get(light.shadow ? shadowedDirectionalLight : directionalLight);
+}
+
+// the lighting shader of the point lights drawn by LightVolumes, their parameters are instance attributes
+Shader* getInstancedLightingShader()
+{
+    static const vector<std::string> instancedPointLight = gBufferDefines({ "INSTANCED_LIGHTS" });
+    return lighting_shaders->Get(instancedPointLight);
+}
+
+// the defines plus the one of the g-buffer layout, sorted for ShaderPermutations
+std::vector<std::string> gBufferDefines(std::vector<std::string> defines)
+{
+    if (config.packedGBuffer)
+        defines.push_back("PACKED_GBUFFER");
+    std::sort(defines.begin(), defines.end());
+    return defines;
 }
 
 void restoreDeferredPass()
 {
     // Restore values
-    glDisable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ZERO);
-    glDisable(GL_DEPTH_CLAMP);
-    glCullFace(GL_BACK);
-    glDisable(GL_CULL_FACE);
-    glDepthMask(true);
-    glEnable(GL_DEPTH_TEST);
+    renderState.disable(GL_BLEND);
+    renderState.blendFunc(GL_ONE, GL_ZERO);
+    renderState.disable(GL_DEPTH_CLAMP);
+    renderState.cullFace(GL_BACK);
+    renderState.disable(GL_CULL_FACE);
+    renderState.depthMask(true);
+    renderState.enable(GL_DEPTH_TEST);
 }
 
-void drawDeferredLight(Light& light)
+void drawDeferredLight(Light& light, int atlasLight)
 {
-    setLightUniforms(light, &camera);
+    setLightUniforms(light, &camera, atlasLight);
     // Select geometry to render
     if (light.radius == 0)
     {
@@ -661,15 +993,14 @@ void drawDeferredLight(Light& light)
 
 void drawFullscreenPass(const char* sourceTextureName, GLuint sourceTexture)
 {
-    glDisable(GL_DEPTH_TEST);
+    renderState.disable(GL_DEPTH_TEST);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, sourceTexture);
+    renderState.bindTexture(0, GL_TEXTURE_2D, sourceTexture);
     shader->setInt(sourceTextureName, 0);
 
     drawQuad();
 
-    glEnable(GL_DEPTH_TEST);
+    renderState.enable(GL_DEPTH_TEST);
 }
 
 void initFrameBuffers(GLFWwindow* window)
@@ -681,25 +1012,40 @@ void initFrameBuffers(GLFWwindow* window)
 
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
+    gBufferWidth = width;
+    gBufferHeight = height;
+
+    // the packed layout keeps metalness with the albedo, the normal as an octahedron and roughness in 8 bits,
+    // 9 bytes per pixel instead of 12 (SRGB8 is stored with 4 bytes)
+    bool packed = config.packedGBuffer;
 
     // albedo color buffer
     glGenTextures(1, &gAlbedo);
     glBindTexture(GL_TEXTURE_2D, gAlbedo);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    if (packed)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
     // normal color buffer
     glGenTextures(1, &gNormal);
     glBindTexture(GL_TEXTURE_2D, gNormal);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, NULL);
+    if (packed)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, width, height, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
     // others color buffer
     glGenTextures(1, &gOthers);
     glBindTexture(GL_TEXTURE_2D, gOthers);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    if (packed)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
@@ -743,32 +1089,20 @@ void initFrameBuffers(GLFWwindow* window)
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gDepth, 0);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-
-    // TODO 9.3 : Generate 2 frame buffers (variable tempBuffers) and 2 textures (variable tempTextures)
-    glGenFramebuffers(2, tempBuffers);
-    glGenTextures(2, tempTextures);
-
-    for (int i = 0; i < 2; ++i)
-    {
-        // TODO 9.3 : Bind and configure temp textures with the same format as the accumulation buffer
-        glBindTexture(GL_TEXTURE_2D, tempTextures[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        // TODO 9.3 : Bind temp framebuffers and attach the corresponding temp texture as color attachment 0
-        glBindFramebuffer(GL_FRAMEBUFFER, tempBuffers[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tempTextures[i], 0);
-    }
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void deleteFrameBuffers()
+{
+    glDeleteFramebuffers(1, &gBuffer);
+    glDeleteFramebuffers(1, &accumBuffer);
+    GLuint textures[5] = { gAlbedo, gNormal, gOthers, gAccum, gDepth };
+    glDeleteTextures(5, textures);
 }
 
-void setLightUniforms(Light& light, Camera* viewSpace)
+void setLightUniforms(Light& light, Camera* viewSpace, int atlasLight)
 {
     glm::vec3 position = light.position;
-    glm::mat4 shadowMatrix = lightSpaceMatrix;
+    glm::mat4 inverseView = glm::mat4(1.0f);
 
     // if a camera is provided, the light position will be relative to it, in view space
     if (viewSpace)
@@ -778,7 +1112,7 @@ void setLightUniforms(Light& light, Camera* viewSpace)
 
         if (light.shadow)
         {
-            shadowMatrix = lightSpaceMatrix * glm::inverse(viewSpace->GetViewMatrix());
+            inverseView = glm::inverse(viewSpace->GetViewMatrix());
         }
     }
 
@@ -788,20 +1122,47 @@ void setLightUniforms(Light& light, Camera* viewSpace)
     shader->setFloat("lightRadius", light.radius);
 
     // shadow uniforms
-    if (light.shadow)
+    if (light.shadow && light.radius == 0)
     {
-        shader->setMat4("lightSpaceMatrix", shadowMatrix);
+        cascadedShadowMap->SetUniforms(*shader, inverseView);
         shader->setInt("ShadowMap", 5);
-        glActiveTexture(GL_TEXTURE5);
-        glBindTexture(GL_TEXTURE_2D, shadowMap);
+        renderState.bindTexture(5, GL_TEXTURE_2D_ARRAY, cascadedShadowMap->Texture());
         //shader->setFloat("shadowBias", config.shadowBias * 0.01f);
     }
+    else if (atlasLight >= 0)
+    {
+        shadowAtlas->SetUniforms(*shader, (unsigned int)atlasLight, inverseView);
+        shader->setInt("ShadowAtlas", 5);
+        renderState.bindTexture(5, GL_TEXTURE_2D, shadowAtlas->Texture());
+    }
+}
+
+void updateExtraLights()
+{
+    // lights 1 and 2 come first, the extra ones are added or removed at the end
+    const size_t lightCount = 2 + (size_t)std::max(config.extraLightCount, 0);
+    if (config.lights.size() > lightCount)
+        config.lights.erase(config.lights.begin() + lightCount, config.lights.end());
+
+    // scattered around the car, each one placed from its index so it stays where it was when the count changes
+    while (config.lights.size() < lightCount)
+    {
+        // braces evaluate the draws left to right, the order of unspecified argument evaluation would differ per compiler
+        std::mt19937 random((unsigned int)config.lights.size());
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        glm::vec3 position{unit(random) * 12.0f - 6.0f, 0.1f + unit(random) * 1.5f, unit(random) * 12.0f - 6.0f};
+        glm::vec3 color{unit(random), unit(random), unit(random)};
+        config.lights.emplace_back(position, color, 0.5f, 0.5f + unit(random) * 1.5f);
+    }
+
+    for (size_t i = 2; i < config.lights.size(); i++)
+        config.lights[i].shadow = config.extraLightShadows;
 }
 
 void updateCameraMatrices()
 {
     view = camera.GetViewMatrix();
-    projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    projection = glm::perspective(glm::radians(camera.Zoom), (float)gBufferWidth / (float)gBufferHeight, 0.1f, 100.0f);
 
     viewProjection = projection * view;
 }
@@ -883,34 +1244,43 @@ unsigned int initSkyboxBuffers() {
 // -------------------------------------------------------
 unsigned int loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrComponents;
+    // the six faces are converted once into a container with all their mip levels, later runs only map it
+    std::string containerFile = TextureContainer::containerPath(faces[0] + ".cube", true);
+    bool upToDate = true;
     for (unsigned int i = 0; i < faces.size(); i++)
+        upToDate = upToDate && TextureContainer::isUpToDate(containerFile, faces[i]);
+
+    TextureContainer container;
+    if (!upToDate || !container.load(containerFile))
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        // decode the six faces in parallel
+        vector<DecodedImage> images = ImageDecoder::decode(faces, 3);
+        bool complete = true;
+        for (unsigned int i = 0; i < images.size(); i++)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_SRGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            if (!images[i].data)
+            {
+                std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+                complete = false;
+            }
         }
-        else
+        if (complete)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            container = TextureContainer::fromImages(images, true, TextureContainer::defaultCompression(3));
+            container.write(containerFile);
         }
+        for (unsigned int i = 0; i < images.size(); i++)
+            images[i].free();
     }
+
+    unsigned int textureID = container.upload();
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_MIRRORED_REPEAT);
 
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    renderState.bindTexture(0, GL_TEXTURE_CUBE_MAP, 0);
 
     return textureID;
 }
@@ -1024,9 +1394,9 @@ void drawCube()
 void drawSkybox()
 {
     // render skybox
-    glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+    renderState.depthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
     skybox_shader->use();
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)gBufferWidth / (float)gBufferHeight, 0.1f, 100.0f);
     glm::mat4 view = camera.GetViewMatrix();
     skybox_shader->setMat4("projection", projection);
     skybox_shader->setMat4("view", view);
@@ -1034,34 +1404,10 @@ void drawSkybox()
 
     // skybox cube
     glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    renderState.bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
-    glDepthFunc(GL_LESS); // set depth function back to default
-}
-
-
-void createShadowMap()
-{
-    // create depth texture
-    glGenTextures(1, &shadowMap);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // if you replace GL_LINEAR with GL_NEAREST you will see pixelation in the borders of the shadow
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // if you replace GL_LINEAR with GL_NEAREST you will see pixelation in the borders of the shadow
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    // attach depth texture as FBO's depth buffer
-    glGenFramebuffers(1, &shadowMapFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    renderState.depthFunc(GL_LESS); // set depth function back to default
 }
 
 
@@ -1073,43 +1419,101 @@ void drawShadowMap()
     // setup depth shader
     shader->use();
 
-    // We use an ortographic projection since it is a directional light.
-    // left, right, bottom, top, near and far values define the 3D volume relative to
-    // the light position and direction that will be rendered to produce the depth texture.
-    // Geometry outside of this range will not be considered when computing shadows.
-    float near_plane = 1.0f;
-    float shadowMapSize = 6.0f;
-    float shadowMapDepthRange = 10.0f;
-    float half = shadowMapSize / 2.0f;
-    glm::mat4 lightProjection = glm::ortho(-half, half, -half, half, near_plane, near_plane + shadowMapDepthRange);
-    glm::mat4 lightView = glm::lookAt(glm::normalize(config.lights[0].position) * shadowMapDepthRange * 0.5f, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-    lightSpaceMatrix = lightProjection * lightView;
-    shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
-
-    // setup framebuffer size
-    int viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-
-    // bind our depth texture to the frame buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-
-    // clear the depth texture/depth buffer
-    glClear(GL_DEPTH_BUFFER_BIT);
+    // We use ortographic projections since it is a directional light.
+    // Each cascade covers a part of the view frustum, up to the shadow distance, and the objects
+    // between it and the light. Geometry outside of the cascades will not cast shadows.
+    cascadedShadowMap->Update(view, glm::radians(camera.Zoom), (float)gBufferWidth / (float)gBufferHeight, 0.1f, config.shadowDistance,
+                              config.lights[0].position, config.cascadeCount, config.cascadeSplitLambda, 10.0f);
 
-    // draw scene from the light's perspective into the depth texture
-    drawObjects();
+    // nothing is drawn into a cascade if it, the light and the objects didn't change since the last time
+    if (!config.cacheShadowMap)
+        cascadedShadowMap->Invalidate();
 
-    // unbind the depth texture from the frame buffer, now we can render to the screen (frame buffer) again
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    // draw scene from the light's perspective into the layers of the depth texture
+    for (int i = 0; i < cascadedShadowMap->CascadeCount(); i++)
+    {
+        shader->setMat4("lightSpaceMatrix", cascadedShadowMap->LightSpaceMatrix(i));
+        shadowCascade = i;
+        cascadedShadowMap->Draw(i, staticSceneVersion, dynamicSceneVersion,
+                                []() { drawObjects(true, false); }, []() { drawObjects(false, true); });
+    }
+    shadowCascade = -1;
 
     shader = currShader;
 }
 
-void drawObjects()
+// draws the shadows of the point lights that changed into the atlas, the ones that are the largest on screen first
+void drawShadowAtlas()
+{
+    shadowAtlas->BeginFrame((unsigned int)config.shadowAtlasUpdates);
+    if (config.pointLightShadows)
+    {
+        Shader* currShader = shader;
+        shader = shadowMap_shader;
+        shader->use();
+
+        // the radius of every shadowed light on screen, in pixels
+        float projectionScale = (float)gBufferHeight / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
+        std::vector<std::pair<float, unsigned int> > shadowedLights;
+        for (unsigned int i = 0; i < config.lights.size(); i++)
+        {
+            const Light& light = config.lights[i];
+            if (light.radius > 0 && light.shadow)
+            {
+                float distance = std::max(glm::length(light.position - camera.Position), light.radius);
+                shadowedLights.push_back(std::make_pair(light.radius / distance * projectionScale, i));
+            }
+        }
+        std::sort(shadowedLights.begin(), shadowedLights.end(), std::greater<std::pair<float, unsigned int> >());
+
+        // the wheels only change the shadows of the lights that reach the car
+        glm::vec3 carCenter, wheelCenter;
+        float carRadius, wheelRadius;
+        carBodyModel->GetBoundingSphere(glm::mat4(1.0f), carCenter, carRadius);
+        carWheelModel->GetBoundingSphere(glm::mat4(1.0f), wheelCenter, wheelRadius);
+
+        for (size_t i = 0; i < shadowedLights.size(); i++)
+        {
+            const Light& light = config.lights[shadowedLights[i].second];
+
+            // a texel of the faces for about every pixel the light covers
+            GLsizei tileSize = 1;
+            while ((float)tileSize < shadowedLights[i].first)
+                tileSize *= 2;
+            bool reachesWheels = glm::length(light.position - carCenter) < light.radius + carRadius + 2.0f * wheelRadius;
+            unsigned int version = staticSceneVersion + (reachesWheels ? dynamicSceneVersion : 0);
+
+            shadowLightBounds = glm::vec4(light.position, light.radius);
+            shadowAtlas->Update(shadowedLights[i].second, light.position, light.radius, tileSize, version, [](const glm::mat4& lightSpaceMatrix)
+            {
+                shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+                drawObjects();
+            });
+        }
+        shadowLightBounds = glm::vec4(0.0f);
+
+        shader = currShader;
+    }
+    shadowAtlas->EndFrame();
+}
+
+// whether the model, placed with the transform, is in the shadow cascade or reach of the point light being drawn.
+// outside of the shadow passes it always is
+bool castsShadow(const Model &model, const glm::mat4 &transform)
+{
+    if (shadowCascade < 0 && shadowLightBounds.w <= 0.0f)
+        return true;
+
+    glm::vec3 center;
+    float radius;
+    model.GetBoundingSphere(transform, center, radius);
+    if (shadowLightBounds.w > 0.0f)
+        return glm::length(center - glm::vec3(shadowLightBounds.x, shadowLightBounds.y, shadowLightBounds.z)) < radius + shadowLightBounds.w;
+    return cascadedShadowMap->Contains(shadowCascade, center, radius);
+}
+
+// the static objects, the dynamic ones (the wheels), or both
+void drawObjects(bool drawStatic, bool drawDynamic)
 {
     // the typical transformation uniforms are already set for you, these are:
     // model (for each model part we draw)
@@ -1122,48 +1526,69 @@ void drawObjects()
 
     glm::mat4 model = glm::mat4(1.0f);
     shader->setMat4("model", model);
-    carPaintModel->Draw(*shader);
+    if (drawStatic && castsShadow(*carPaintModel, model))
+        carPaintModel->Draw(*shader);
 
     // material uniforms for other car parts (hardcoded)
     shader->setVec3("reflectionColor", 1.0f, 1.0f, 1.0f);
     shader->setFloat("roughness", 0.35f);
     shader->setFloat("metalness", 0.0f);
 
-    carBodyModel->Draw(*shader);
-
     // draw car
     shader->setMat4("model", model);
-    carLightModel->Draw(*shader);
-    carInteriorModel->Draw(*shader);
+    // the interior and the lights are inside the body
+    if (drawStatic && castsShadow(*carBodyModel, model))
+    {
+        if (config.mergeCarMeshes)
+            carBatch->Draw(*shader);
+        else
+        {
+            carBodyModel->Draw(*shader);
+            carLightModel->Draw(*shader);
+            carInteriorModel->Draw(*shader);
+        }
+    }
 
-    // draw wheel
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, 1.39f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+    if (drawDynamic)
+    {
+        // the wheels turn around their axle, the ones on the other side are mirrored so they turn the other way
+        glm::mat4 spin = glm::rotate(glm::mat4(1.0f), wheelAngle, glm::vec3(1.0, 0.0, 0.0));
+        glm::mat4 mirroredSpin = glm::rotate(glm::mat4(1.0f), -wheelAngle, glm::vec3(1.0, 0.0, 0.0));
 
-    // draw wheel
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, -1.28f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+        // draw wheel
+        model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, 1.39f)) * spin;
+        shader->setMat4("model", model);
+        if (castsShadow(*carWheelModel, model))
+            carWheelModel->Draw(*shader);
 
-    // draw wheel
-    model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
-    model = glm::translate(model, glm::vec3(-.7432f, .328f, 1.28f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+        // draw wheel
+        model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, -1.28f)) * spin;
+        shader->setMat4("model", model);
+        if (castsShadow(*carWheelModel, model))
+            carWheelModel->Draw(*shader);
 
-    // draw wheel
-    model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
-    model = glm::translate(model, glm::vec3(-.7432f, .328f, -1.39f));
-    shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+        // draw wheel
+        model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
+        model = glm::translate(model, glm::vec3(-.7432f, .328f, 1.28f)) * mirroredSpin;
+        shader->setMat4("model", model);
+        if (castsShadow(*carWheelModel, model))
+            carWheelModel->Draw(*shader);
+
+        // draw wheel
+        model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
+        model = glm::translate(model, glm::vec3(-.7432f, .328f, -1.39f)) * mirroredSpin;
+        shader->setMat4("model", model);
+        if (castsShadow(*carWheelModel, model))
+            carWheelModel->Draw(*shader);
+    }
 
     // draw floor
     model = glm::scale(glm::mat4(1.0), glm::vec3(5.f, 5.f, 5.f));
     shader->setMat4("model", model);
     shader->setFloat("roughness", 0.9f);
     shader->setVec4("texCoordTransform", glm::vec4(4.0f, 4.0f, 0, 0));
-    floorModel->Draw(*shader);
+    if (drawStatic && castsShadow(*floorModel, model))
+        floorModel->Draw(*shader);
     shader->setVec4("texCoordTransform", glm::vec4(1, 1, 0, 0));
 
     shader->setFloat("roughness", 0.05f);
@@ -0,0 +1,204 @@
+#ifndef MESH_BATCH_H
+#define MESH_BATCH_H
+
+#include <glad/glad.h>
+
+#include <mesh.h>
+#include <model.h>
+#include <shader.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+// the layout glMultiDrawElementsIndirect reads from the GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// merges the meshes of one or more models into a single vertex and index buffer, so all of them are drawn from one VAO.
+// the meshes become commands of an indirect buffer, grouped by their textures, and every group is a single
+// glMultiDrawElementsIndirect. without GL 4.3 the commands are issued one by one with glDrawElementsInstancedBaseVertex.
+// all the meshes of a batch are drawn with the same uniforms, so only merge models that share their transform and material
+class MeshBatch
+{
+public:
+    MeshBatch(VertexFormat format = VertexFormat::Float) : format(format), indirectBuffer(0), uploadedInstanceCount(1)
+    {
+    }
+
+    ~MeshBatch()
+    {
+        if (indirectBuffer != 0)
+            glDeleteBuffers(1, &indirectBuffer);
+    }
+
+    // batches own their indirect buffer, so they can't be copied
+    MeshBatch(const MeshBatch&) = delete;
+    MeshBatch& operator=(const MeshBatch&) = delete;
+
+    // queues the meshes of a model at the given level of detail. call Build once all the models are added
+    void Add(const Model &model, unsigned int lod = 0)
+    {
+        for (unsigned int i = 0; i < model.meshes.size(); i++)
+        {
+            const Mesh &mesh = model.meshes[i];
+            unsigned int level = std::min(lod, (unsigned int)mesh.lods.size());
+            const vector<unsigned int> &meshIndices = level == 0 ? mesh.indices : mesh.lods[level - 1].indices;
+
+            DrawElementsIndirectCommand command;
+            command.count = (GLuint)meshIndices.size();
+            command.instanceCount = 1;
+            command.firstIndex = (GLuint)indices.size();
+            command.baseVertex = (GLint)vertices.size();
+            command.baseInstance = 0;
+
+            // meshes with the same textures are drawn together
+            vector<unsigned int> textureIds;
+            for (unsigned int t = 0; t < mesh.textures.size(); t++)
+                textureIds.push_back(mesh.textures[t].id);
+            map<vector<unsigned int>, unsigned int>::iterator group = groupByTextures.find(textureIds);
+            if (group == groupByTextures.end())
+            {
+                group = groupByTextures.insert(make_pair(textureIds, (unsigned int)groups.size())).first;
+                groups.push_back(Group());
+                groups.back().textures = mesh.textures;
+            }
+            groups[group->second].commands.push_back(command);
+
+            // indices stay relative to the mesh, baseVertex offsets them
+            vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+        }
+    }
+
+    // uploads the merged buffers and the commands
+    void Build()
+    {
+        if (vertices.empty())
+            return;
+        geometry.reset(new Mesh(vertices, indices, vector<Texture>(), format));
+
+        // the commands of a group are consecutive in the indirect buffer
+        vector<DrawElementsIndirectCommand> commands;
+        for (unsigned int i = 0; i < groups.size(); i++)
+        {
+            groups[i].firstCommand = (unsigned int)commands.size();
+            commands.insert(commands.end(), groups[i].commands.begin(), groups[i].commands.end());
+        }
+
+        if (supportsMultiDrawIndirect())
+        {
+            glGenBuffers(1, &indirectBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0], GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+
+        // the geometry keeps its own copy
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+    }
+
+    // draws every mesh of the batch, instanceCount times
+    void Draw(Shader &shader, GLsizei instanceCount = 1)
+    {
+        if (!geometry || !geometry->Uploaded())
+            return;
+
+        geometry->SetVertexFormatUniforms(shader);
+        glBindVertexArray(geometry->VAO);
+
+        if (indirectBuffer != 0)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            if (instanceCount != uploadedInstanceCount)
+                updateInstanceCount(instanceCount);
+        }
+
+        for (unsigned int i = 0; i < groups.size(); i++)
+        {
+            const Group &group = groups[i];
+            Mesh::BindTextures(shader, group.textures);
+            if (indirectBuffer != 0)
+            {
+                const void *firstCommand = (const void*)(group.firstCommand * sizeof(DrawElementsIndirectCommand));
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, firstCommand, (GLsizei)group.commands.size(), 0);
+            }
+            else
+            {
+                for (unsigned int c = 0; c < group.commands.size(); c++)
+                {
+                    const DrawElementsIndirectCommand &command = group.commands[c];
+                    const void *firstIndex = (const void*)(command.firstIndex * sizeof(unsigned int));
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)command.count, GL_UNSIGNED_INT, firstIndex, instanceCount, command.baseVertex);
+                }
+            }
+        }
+
+        if (indirectBuffer != 0)
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+        RenderState::instance().activeTexture(0);
+    }
+
+    // number of meshes in the batch
+    unsigned int DrawCount() const
+    {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < groups.size(); i++)
+            count += (unsigned int)groups[i].commands.size();
+        return count;
+    }
+
+    // number of texture sets, each one a multi draw call when GL 4.3 is available
+    unsigned int GroupCount() const
+    {
+        return (unsigned int)groups.size();
+    }
+
+    // glMultiDrawElementsIndirect is core in GL 4.3, the exercises might run on a lower version
+    static bool supportsMultiDrawIndirect()
+    {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+private:
+    struct Group
+    {
+        vector<Texture> textures;
+        vector<DrawElementsIndirectCommand> commands;
+        unsigned int firstCommand;
+    };
+
+    VertexFormat format;
+    vector<Vertex> vertices;     // merged vertices, until Build
+    vector<unsigned int> indices; // merged indices, until Build
+    vector<Group> groups;
+    map<vector<unsigned int>, unsigned int> groupByTextures;
+    std::unique_ptr<Mesh> geometry;
+    unsigned int indirectBuffer;
+    GLsizei uploadedInstanceCount;
+
+    // rewrites the instance count of every command, only when it changes
+    void updateInstanceCount(GLsizei instanceCount)
+    {
+        vector<DrawElementsIndirectCommand> commands;
+        for (unsigned int i = 0; i < groups.size(); i++)
+        {
+            for (unsigned int c = 0; c < groups[i].commands.size(); c++)
+            {
+                groups[i].commands[c].instanceCount = (GLuint)instanceCount;
+                commands.push_back(groups[i].commands[c]);
+            }
+        }
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0]);
+        uploadedInstanceCount = instanceCount;
+    }
+};
+#endif
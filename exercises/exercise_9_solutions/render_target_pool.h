@@ -0,0 +1,225 @@
+#ifndef RENDER_TARGET_POOL_H
+#define RENDER_TARGET_POOL_H
+
+#include <glad/glad.h>
+
+#include <render_state.h>
+
+#include <algorithm>
+#include <vector>
+
+// a texture and the framebuffer it is attached to, for one pass of a frame
+struct RenderTarget
+{
+    GLuint framebuffer, texture;
+    int width, height;
+    GLenum format;
+    GLsizei samples;
+
+    // binds the framebuffer, with a viewport of its size
+    void Bind() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+    }
+};
+
+// the transient targets of the post-processing passes. a pass acquires a target of a size, format and number of samples
+// for as long as it needs it and releases it afterwards, and a later pass that asks for the same kind of target gets
+// the released one instead of a new one. targets whose lifetimes don't overlap share memory, so adding a pass only
+// costs memory when its targets are alive at the same time as the others. targets that nobody acquired for a few
+// frames are deleted, like the ones of the old size after the window is resized
+class RenderTargetPool
+{
+public:
+    RenderTargetPool() : frame(0), acquiredThisFrame(0), acquiredLastFrame(0) {}
+
+    ~RenderTargetPool()
+    {
+        for (size_t i = 0; i < entries.size(); i++)
+            deleteEntry(entries[i]);
+    }
+
+    // the pool owns GL objects, so it can't be copied
+    RenderTargetPool(const RenderTargetPool&) = delete;
+    RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+
+    // format is the internal format, color or depth. the target stays the caller's until it is released, its contents
+    // are whatever the last pass that used it left there
+    RenderTarget* Acquire(int width, int height, GLenum format, GLsizei samples = 1)
+    {
+        // a minimized window has a size of 0
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+        samples = std::max(samples, 1);
+        acquiredThisFrame++;
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            Entry* entry = entries[i];
+            const RenderTarget& target = entry->target;
+            if (!entry->inUse && target.width == width && target.height == height && target.format == format && target.samples == samples)
+            {
+                entry->inUse = true;
+                entry->lastUsedFrame = frame;
+                return &entry->target;
+            }
+        }
+
+        Entry* entry = createEntry(width, height, format, samples);
+        entries.push_back(entry);
+        return &entry->target;
+    }
+
+    // the target can be handed out to the next pass that asks for one like it, this frame or a later one
+    void Release(RenderTarget* target)
+    {
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (&entries[i]->target == target)
+            {
+                entries[i]->inUse = false;
+                return;
+            }
+        }
+    }
+
+    // once per frame, after the last pass. deletes the targets that weren't acquired for FRAMES_TO_KEEP frames
+    void EndFrame()
+    {
+        bool deleted = false;
+        for (size_t i = 0; i < entries.size();)
+        {
+            Entry* entry = entries[i];
+            if (!entry->inUse && frame - entry->lastUsedFrame >= FRAMES_TO_KEEP)
+            {
+                deleteEntry(entry);
+                entries[i] = entries.back();
+                entries.pop_back();
+                deleted = true;
+            }
+            else
+                i++;
+        }
+
+        // a deleted texture may still be shadowed as bound, and its name can be given to a new one
+        if (deleted)
+            RenderState::instance().invalidate();
+
+        frame++;
+        acquiredLastFrame = acquiredThisFrame;
+        acquiredThisFrame = 0;
+    }
+
+    unsigned int TargetCount() const { return (unsigned int)entries.size(); }
+    unsigned int AcquiredLastFrame() const { return acquiredLastFrame; }
+
+    size_t MemoryBytes() const
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const RenderTarget& target = entries[i]->target;
+            bytes += (size_t)target.width * target.height * target.samples * bytesPerPixel(target.format);
+        }
+        return bytes;
+    }
+
+private:
+    // long enough that a pass that is only skipped for a frame doesn't create its targets again
+    static const unsigned int FRAMES_TO_KEEP = 3;
+
+    struct Entry
+    {
+        RenderTarget target;
+        bool inUse;
+        unsigned int lastUsedFrame;
+    };
+
+    // entries are allocated one by one, so the targets handed out don't move when the vector grows
+    std::vector<Entry*> entries;
+    unsigned int frame;
+    unsigned int acquiredThisFrame, acquiredLastFrame;
+
+    Entry* createEntry(int width, int height, GLenum format, GLsizei samples)
+    {
+        Entry* entry = new Entry();
+        entry->inUse = true;
+        entry->lastUsedFrame = frame;
+
+        RenderTarget& target = entry->target;
+        target.width = width;
+        target.height = height;
+        target.format = format;
+        target.samples = samples;
+
+        bool depth = isDepthFormat(format);
+        GLenum textureTarget = samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+
+        // the texture binding is put back, it may be cached by the caller
+        GLint boundTexture = 0;
+        glGetIntegerv(samples > 1 ? GL_TEXTURE_BINDING_2D_MULTISAMPLE : GL_TEXTURE_BINDING_2D, &boundTexture);
+
+        glGenTextures(1, &target.texture);
+        glBindTexture(textureTarget, target.texture);
+        if (samples > 1)
+            glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, format, width, height, GL_TRUE);
+        else
+        {
+            GLenum pixelFormat = format == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL : depth ? GL_DEPTH_COMPONENT : GL_RGBA;
+            GLenum pixelType = format == GL_DEPTH24_STENCIL8 ? GL_UNSIGNED_INT_24_8 : GL_FLOAT;
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, pixelFormat, pixelType, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(textureTarget, (GLuint)boundTexture);
+
+        GLenum attachment = format == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : depth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0;
+        glGenFramebuffers(1, &target.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, textureTarget, target.texture, 0);
+        if (depth)
+        {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        return entry;
+    }
+
+    static void deleteEntry(Entry* entry)
+    {
+        glDeleteFramebuffers(1, &entry->target.framebuffer);
+        glDeleteTextures(1, &entry->target.texture);
+        delete entry;
+    }
+
+    static bool isDepthFormat(GLenum format)
+    {
+        return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F || format == GL_DEPTH24_STENCIL8;
+    }
+
+    // an estimate of what the driver allocates, for the stats
+    static size_t bytesPerPixel(GLenum format)
+    {
+        switch (format)
+        {
+        case GL_RGBA32F:
+            return 16;
+        case GL_RGBA16F:
+        case GL_RGB16F:
+            return 8;
+        case GL_DEPTH_COMPONENT16:
+        case GL_R16F:
+            return 2;
+        case GL_R8:
+            return 1;
+        default: // GL_RGBA8, GL_R11F_G11F_B10F, GL_RG16F, GL_R32F, the 24 and 32 bit depth formats
+            return 4;
+        }
+    }
+};
+#endif
@@ -0,0 +1,147 @@
+#ifndef SHADER_BATCH_H
+#define SHADER_BATCH_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <program_cache.h>
+#include <shader.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// builds several shaders at once, so startup waits for the slowest of them instead of all of them in a row.
+// with KHR_parallel_shader_compile (or the ARB version) every program is submitted first and the driver compiles them
+// on its own threads, then they are checked one by one. without it, worker threads with hidden contexts that share
+// objects with the window each build part of the shaders
+class ShaderBatch
+{
+public:
+    // the window whose context the shaders are used in, it must be current on the calling thread
+    ShaderBatch(GLFWwindow *window) : window(window), usedWorkers(0)
+    {
+    }
+
+    // target gets the shader once Compile returns
+    void Add(Shader *&target, const char *vertexPath, const char *fragmentPath, const char *geometryPath = nullptr,
+             const std::vector<std::string> &defines = std::vector<std::string>())
+    {
+        Job job;
+        job.target = &target;
+        job.vertexPath = vertexPath;
+        job.fragmentPath = fragmentPath;
+        job.geometryPath = geometryPath ? geometryPath : "";
+        job.defines = defines;
+        jobs.push_back(job);
+    }
+
+    void Compile(unsigned int maxWorkers = 4)
+    {
+        if (jobs.empty())
+            return;
+
+        if (supportsParallelCompile())
+        {
+            // let the driver pick the number of compiler threads
+            typedef void (*MaxShaderCompilerThreadsProc)(GLuint count);
+            MaxShaderCompilerThreadsProc maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+            if (!maxShaderCompilerThreads)
+                maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+            if (maxShaderCompilerThreads)
+                maxShaderCompilerThreads(0xFFFFFFFF);
+
+            for (unsigned int i = 0; i < jobs.size(); i++)
+                *jobs[i].target = submit(jobs[i]);
+            for (unsigned int i = 0; i < jobs.size(); i++)
+                (*jobs[i].target)->Finish();
+        }
+        else
+            compileOnWorkers(maxWorkers);
+        jobs.clear();
+    }
+
+    // worker threads used by the last Compile, 0 when the driver compiled in parallel on its own
+    unsigned int UsedWorkers() const
+    {
+        return usedWorkers;
+    }
+
+    static bool supportsParallelCompile()
+    {
+        return glfwExtensionSupported("GL_KHR_parallel_shader_compile") || glfwExtensionSupported("GL_ARB_parallel_shader_compile");
+    }
+
+private:
+    struct Job
+    {
+        Shader **target;
+        std::string vertexPath, fragmentPath, geometryPath;
+        std::vector<std::string> defines;
+    };
+
+    GLFWwindow *window;
+    std::vector<Job> jobs;
+    unsigned int usedWorkers;
+
+    static Shader* submit(const Job &job)
+    {
+        const char *geometryPath = job.geometryPath.empty() ? nullptr : job.geometryPath.c_str();
+        return new Shader(job.vertexPath.c_str(), job.fragmentPath.c_str(), geometryPath, false, job.defines);
+    }
+
+    void compileOnWorkers(unsigned int maxWorkers)
+    {
+        unsigned int workerCount = std::min((unsigned int)jobs.size(), std::max(std::min(std::thread::hardware_concurrency(), maxWorkers), 1u));
+
+        // contexts can only be created on the main thread, the workers just make them current
+        std::vector<GLFWwindow*> contexts;
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        for (unsigned int i = 0; i < workerCount; i++)
+        {
+            GLFWwindow *context = glfwCreateWindow(1, 1, "", NULL, window);
+            if (context)
+                contexts.push_back(context);
+        }
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+        // the program cache initializes itself lazily, do it here before the workers share it
+        ProgramCache &programCache = ProgramCache::instance();
+        programCache.supported();
+        programCache.key(std::vector<std::string>());
+
+        std::atomic<unsigned int> nextJob(0);
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < contexts.size(); i++)
+        {
+            GLFWwindow *context = contexts[i];
+            workers.push_back(std::thread([this, context, &nextJob]()
+            {
+                glfwMakeContextCurrent(context);
+                for (unsigned int job = nextJob++; job < jobs.size(); job = nextJob++)
+                {
+                    *jobs[job].target = submit(jobs[job]);
+                    (*jobs[job].target)->Finish();
+                }
+                // the programs have to be complete before the main context uses them
+                glFinish();
+                glfwMakeContextCurrent(NULL);
+            }));
+        }
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+        usedWorkers = (unsigned int)contexts.size();
+
+        for (unsigned int i = 0; i < contexts.size(); i++)
+            glfwDestroyWindow(contexts[i]);
+
+        // whatever is left, if no hidden context could be created, is built here
+        for (unsigned int job = nextJob; job < jobs.size(); job++)
+            *jobs[job].target = submit(jobs[job]);
+        for (unsigned int job = nextJob; job < jobs.size(); job++)
+            (*jobs[job].target)->Finish();
+    }
+};
+#endif
@@ -0,0 +1,67 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <glad/glad.h>
+
+#include <shader.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// the permutations of one set of shader files, each compiled with its own defines. a permutation is only compiled the
+// first time it is asked for, so the ones that are never used cost nothing. this specializes shaders at compile time,
+// e.g. a light type or shadows on/off, instead of branching on uniforms at runtime
+class ShaderPermutations
+{
+public:
+    ShaderPermutations(const char *vertexPath, const char *fragmentPath, const char *geometryPath = nullptr)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath ? geometryPath : "")
+    {
+    }
+
+    ~ShaderPermutations()
+    {
+        for (std::map<std::vector<std::string>, Shader*>::iterator it = permutations.begin(); it != permutations.end(); ++it)
+        {
+            glDeleteProgram(it->second->ID);
+            delete it->second;
+        }
+    }
+
+    // permutations own their programs, so they can't be copied
+    ShaderPermutations(const ShaderPermutations&) = delete;
+    ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+    // the shader built with the defines, "NAME" or "NAME value", in any order. keep sorted define sets around to look
+    // them up without copying
+    Shader* Get(const std::vector<std::string> &defines)
+    {
+        if (!std::is_sorted(defines.begin(), defines.end()))
+        {
+            std::vector<std::string> sorted(defines);
+            std::sort(sorted.begin(), sorted.end());
+            return Get(sorted);
+        }
+
+        std::map<std::vector<std::string>, Shader*>::iterator it = permutations.find(defines);
+        if (it != permutations.end())
+            return it->second;
+
+        Shader *shader = new Shader(vertexPath.c_str(), fragmentPath.c_str(), geometryPath.empty() ? nullptr : geometryPath.c_str(), true, defines);
+        permutations.insert(std::make_pair(defines, shader));
+        return shader;
+    }
+
+    // number of permutations compiled so far
+    unsigned int Count() const
+    {
+        return (unsigned int)permutations.size();
+    }
+
+private:
+    std::string vertexPath, fragmentPath, geometryPath;
+    std::map<std::vector<std::string>, Shader*> permutations;
+};
+#endif
@@ -22,14 +22,14 @@ in vec3 worldNormal;
 in vec3 worldTangent;
 
 // output colors of this fragment
-out vec3 AlbedoGBuffer;
+out vec4 AlbedoGBuffer;
 out vec2 NormalGBuffer;
 out vec4 OthersGBuffer;
 out vec4 AccumBuffer;
 
 
-// Constant Pi
-const float PI = 3.14159265359;
+#include "pbr_lighting.glsl"
+#include "gbuffer.glsl"
 
 
 vec3 GetNormalMap(vec3 normalMap)
@@ -37,7 +37,8 @@ vec3 GetNormalMap(vec3 normalMap)
    // Unpack from range [0, 1] to [-1 , 1]
    normalMap = normalMap * 2.0 - 1.0;
 
-   // This time we are storing Z component in the texture, no need to compute it. Instead we normalize just in case
+   // BC5 compressed normal maps only store X and Y, so Z is computed knowing that the normal length is 1
+   normalMap.z = sqrt(max(1.0 - dot(normalMap.xy, normalMap.xy), 0.0));
    normalMap = normalize(normalMap);
 
    // Create tangent space matrix
@@ -50,18 +51,12 @@ vec3 GetNormalMap(vec3 normalMap)
    return TBN * normalMap;
 }
 
-vec3 FresnelSchlick(vec3 F0, float cosTheta)
-{
-   return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
-}
-
-vec3 GetAmbientLighting(vec3 albedo, vec3 N)
+vec3 GetAmbientLighting(vec3 albedo, vec3 N, float ambientOcclusion)
 {
    vec3 ambient = textureLod(skybox, N, 4.0f).rgb;
 
    ambient *= albedo / PI;
 
-   float ambientOcclusion = texture(texture_ambient1, textureCoordinates).r;
    ambient *= ambientOcclusion;
 
    return ambient;
@@ -84,18 +79,24 @@ void main()
    vec3 albedoMap = texture(texture_diffuse1, textureCoordinates).xyz;
    vec3 albedo = albedoMap * reflectionColor;
 
-   AlbedoGBuffer = albedo;
-
    vec3 normalMap = texture(texture_normal1, textureCoordinates).rgb;
    vec3 N = GetNormalMap(normalMap);
-   NormalGBuffer = (view * vec4(N, 0)).xy;
+   NormalGBuffer = EncodeNormal((view * vec4(N, 0)).xyz);
 
    vec4 specular = texture(texture_specular1, textureCoordinates); // not used, not good sample textures
+   float ambientOcclusion = texture(texture_ambient1, textureCoordinates).r;
+
+#ifdef PACKED_GBUFFER
+   AlbedoGBuffer = vec4(albedo, metalness);
+   OthersGBuffer = vec4(roughness, 0.0f, 0.0f, 0.0f);
+#else
+   AlbedoGBuffer = vec4(albedo, 1.0f);
    OthersGBuffer = vec4(roughness, metalness, 0.0f, 0.0f);
+#endif
 
    vec3 V = normalize(cameraPosition - worldPosition);
 
-   vec3 ambient = GetAmbientLighting(albedo, N);
+   vec3 ambient = GetAmbientLighting(albedo, N, ambientOcclusion);
    ambient = mix(ambient, vec3(0), metalness);
 
    vec3 environment = GetEnvironmentLighting(N, V, roughness);
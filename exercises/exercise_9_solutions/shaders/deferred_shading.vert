@@ -1,32 +1,49 @@
 #version 330 core
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
+layout (location = 1) in vec3 normal;  // octahedral encoded in .xy for packed vertices
 layout (location = 2) in vec2 textCoord;
-layout (location = 3) in vec3 tangent;
+layout (location = 3) in vec3 tangent; // octahedral encoded in .xy for packed vertices
 
 uniform mat4 model; // represents model coordinates in the world coord space
 uniform mat4 viewProjection;  // represents the view and projection matrices combined
 uniform vec4 texCoordTransform; // scale and offset for texture coordinates
 
+// vertex layout of the mesh, quantized positions are relative to the mesh bounds
+uniform bool packedVertices = false;
+uniform vec3 positionOffset = vec3(0.0f);
+uniform vec3 positionScale = vec3(1.0f);
+
 // variables to fragment shader
 out vec2 textureCoordinates;
 out vec3 worldPosition;
 out vec3 worldNormal;
 out vec3 worldTangent;
 
+vec3 octahedralDecode(vec2 encoded)
+{
+   vec3 v = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+   // the lower half of the octahedron is folded over the corners
+   if (v.z < 0.0f)
+      v.xy = (1.0f - abs(v.yx)) * vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+   return normalize(v);
+}
+
 void main() {
+   vec3 position = positionOffset + vertex * positionScale;
+   vec3 vertexNormal = packedVertices ? octahedralDecode(normal.xy) : normal;
+   vec3 vertexTangent = packedVertices ? octahedralDecode(tangent.xy) : tangent;
 
    // Read the texture coordinates from the attribute and pass it to the fragment shader
    textureCoordinates = textCoord * texCoordTransform.xy + texCoordTransform.zw;
 
    // Compute the position in world space and pass it to the fragment shader
-   worldPosition =  (model * vec4(vertex, 1.0f)).xyz;
+   worldPosition =  (model * vec4(position, 1.0f)).xyz;
 
    // Compute the normal in world space and pass it to the fragment shader
-   worldNormal = (model * vec4(normal, 0.0f)).xyz;
+   worldNormal = (model * vec4(vertexNormal, 0.0f)).xyz;
 
    // Compute the tangent in world space and pass it to the fragment shader
-   worldTangent = (model * vec4(tangent, 0.0f)).xyz;
+   worldTangent = (model * vec4(vertexTangent, 0.0f)).xyz;
 
    // Final vertex position (for opengl rendering, not for lighting)
    gl_Position = viewProjection * vec4(worldPosition, 1);
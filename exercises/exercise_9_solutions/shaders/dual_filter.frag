@@ -0,0 +1,41 @@
+#version 330 core
+
+// the dual filter of the bloom mip chain: downsamples a level into the next one, or with UPSAMPLE, upsamples it back
+// into the one above, see bloom_mip_chain.h. the taps are between texels, so each one averages four of them
+
+// material textures
+uniform sampler2D SourceTexture;
+
+// uniforms
+uniform vec2 halfTexel; // half a texel of SourceTexture, in texture coordinates
+
+// variables from vertex shader
+in vec2 textureCoordinates;
+
+// output color of this fragment
+out vec4 FragColor;
+
+
+void main()
+{
+#ifdef UPSAMPLE
+   // a tent around the pixel: four taps on the axes, and four diagonal ones that count twice
+   vec3 color = texture(SourceTexture, textureCoordinates + vec2(-halfTexel.x * 2.0, 0.0)).rgb;
+   color += texture(SourceTexture, textureCoordinates + vec2(halfTexel.x * 2.0, 0.0)).rgb;
+   color += texture(SourceTexture, textureCoordinates + vec2(0.0, -halfTexel.y * 2.0)).rgb;
+   color += texture(SourceTexture, textureCoordinates + vec2(0.0, halfTexel.y * 2.0)).rgb;
+   color += texture(SourceTexture, textureCoordinates + vec2(-halfTexel.x, halfTexel.y)).rgb * 2.0;
+   color += texture(SourceTexture, textureCoordinates + vec2(halfTexel.x, halfTexel.y)).rgb * 2.0;
+   color += texture(SourceTexture, textureCoordinates + vec2(-halfTexel.x, -halfTexel.y)).rgb * 2.0;
+   color += texture(SourceTexture, textureCoordinates + vec2(halfTexel.x, -halfTexel.y)).rgb * 2.0;
+   FragColor = vec4(color / 12.0, 1.0);
+#else
+   // the center counts four times, the four corners once
+   vec3 color = texture(SourceTexture, textureCoordinates).rgb * 4.0;
+   color += texture(SourceTexture, textureCoordinates - halfTexel).rgb;
+   color += texture(SourceTexture, textureCoordinates + halfTexel).rgb;
+   color += texture(SourceTexture, textureCoordinates + vec2(halfTexel.x, -halfTexel.y)).rgb;
+   color += texture(SourceTexture, textureCoordinates - vec2(halfTexel.x, -halfTexel.y)).rgb;
+   FragColor = vec4(color / 8.0, 1.0);
+#endif
+}
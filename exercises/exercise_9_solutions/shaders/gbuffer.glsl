@@ -0,0 +1,82 @@
+// layout of the g-buffers and reconstruction of the view space surface from them, include it after #version
+//
+// default layout: albedo SRGB8, view normal XY RG16F, roughness and metalness SRGB8_ALPHA8
+// PACKED_GBUFFER: albedo and metalness SRGB8_ALPHA8, octahedral view normal RG16, roughness R8. ambient occlusion only
+// darkens the ambient light, which the geometry pass adds itself, so it isn't stored
+
+// transform matrices
+uniform mat4 invProjection; // transform from clip space to view space
+
+vec3 ReconstructPosition(vec4 projPosition, float depth)
+{
+   // Transform depth to range [-1, 1]
+   depth = depth * 2 - 1;
+
+   // Reconstruct clipPosition from projPosition(X,Y) and depth (Z)
+   vec3 clipPosition = vec3(projPosition.xy / projPosition.w, depth);
+
+   // Multiply clipPosition by inverse projection matrix to change to view space
+   vec4 P = invProjection * vec4(clipPosition, 1.0f);
+
+   // Divide by P.w after projecting
+   P = P / P.w;
+
+   return P.xyz;
+}
+
+vec3 ReconstructNormal(vec2 normalMap)
+{
+   vec3 normal = vec3(normalMap, 0);
+   // Reconstruct Z component of the normal, knowing that the normal length is 1  (X*X + Y*Y + Z*Z = 1)
+   normal.z = sqrt(1 - normal.x*normal.x - normal.y*normal.y);
+   return normal;
+}
+
+#ifdef PACKED_GBUFFER
+// the octahedron folds the sphere on a square: the upper half is projected on it, the lower half folded over its corners.
+// unlike XY with a reconstructed Z, normals facing away from the camera (seen at grazing angles) survive
+vec2 OctahedronWrap(vec2 v)
+{
+   return (1.0f - abs(v.yx)) * vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+vec2 EncodeNormal(vec3 N)
+{
+   N /= abs(N.x) + abs(N.y) + abs(N.z);
+   vec2 octahedron = N.z >= 0.0f ? N.xy : OctahedronWrap(N.xy);
+   // to the range [0, 1] of the unsigned normalized texture
+   return octahedron * 0.5f + 0.5f;
+}
+
+vec3 DecodeNormal(vec2 normalMap)
+{
+   normalMap = normalMap * 2.0f - 1.0f;
+   vec3 N = vec3(normalMap, 1.0f - abs(normalMap.x) - abs(normalMap.y));
+   float fold = clamp(-N.z, 0.0f, 1.0f);
+   N.xy += vec2(N.x >= 0.0f ? -fold : fold, N.y >= 0.0f ? -fold : fold);
+   return normalize(N);
+}
+#else
+vec2 EncodeNormal(vec3 N)
+{
+   return N.xy;
+}
+
+vec3 DecodeNormal(vec2 normalMap)
+{
+   return ReconstructNormal(normalMap);
+}
+#endif
+
+// the surface of a pixel from its g-buffer texels
+void DecodeGBuffer(vec4 albedoTexel, vec2 normalTexel, vec4 othersTexel, out vec3 albedo, out vec3 N, out float roughness, out float metalness)
+{
+   albedo = albedoTexel.rgb;
+   N = DecodeNormal(normalTexel);
+   roughness = othersTexel.r;
+#ifdef PACKED_GBUFFER
+   metalness = albedoTexel.a;
+#else
+   metalness = othersTexel.g;
+#endif
+}
@@ -6,10 +6,32 @@ uniform mat4 viewProjection;  // represents the view and projection matrices com
 
 out vec4 projPosition;
 
+#ifdef INSTANCED_LIGHTS
+// one point light per instance, in view space, see light_volumes.h
+layout (location = 1) in vec4 instancePositionRadius;
+layout (location = 2) in vec3 instanceRadiance;
+
+uniform mat4 projection;
+
+// the light uniforms of the fragment shader, passed on without interpolation
+flat out vec3 lightPosition;
+flat out vec3 lightColor;
+flat out float lightRadius;
+#endif
+
 void main()
 {
+#ifdef INSTANCED_LIGHTS
+   lightPosition = instancePositionRadius.xyz;
+   lightColor = instanceRadiance;
+   lightRadius = instancePositionRadius.w;
+
+   // The sphere is positioned at the center of the light, with a size equal to the radius
+   projPosition = projection * vec4(lightPosition + vertex * lightRadius, 1.0);
+#else
    // Pass the projected position to fragment shader
    projPosition = viewProjection * model * vec4(vertex, 1.0);
+#endif
 
    gl_Position = projPosition;
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+// physically based BRDF shared by the lighting shaders, include it after #version
+
+// Constant Pi
+const float PI = 3.14159265359;
+
+
+// Schlick approximation of the Fresnel term
+vec3 FresnelSchlick(vec3 F0, float cosTheta)
+{
+   return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+
+float DistributionGGX(vec3 N, vec3 H, float a)
+{
+   float a2 = a*a;
+   float NdotH = max(dot(N, H), 0.0);
+   float NdotH2 = NdotH*NdotH;
+
+   float num = a2;
+   float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+   denom = PI * denom * denom;
+
+   return num / denom;
+}
+
+float GeometrySchlickGGX(float cosAngle, float a)
+{
+   float a2 = a*a;
+
+   float num = 2 * cosAngle;
+   float denom = cosAngle + sqrt(a2 + (1 - a2)*cosAngle*cosAngle);
+
+   return num / denom;
+}
+
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float a)
+{
+   float NdotV = max(dot(N, V), 0.0);
+   float NdotL = max(dot(N, L), 0.0);
+   float ggx2  = GeometrySchlickGGX(NdotV, a);
+   float ggx1  = GeometrySchlickGGX(NdotL, a);
+
+   return ggx1 * ggx2;
+}
+
+vec3 GetCookTorranceSpecularLighting(vec3 N, vec3 L, vec3 V, float roughness)
+{
+   vec3 H = normalize(L + V);
+
+   // Remap alpha parameter to roughness^2
+   float a = roughness * roughness;
+
+   float D = DistributionGGX(N, H, a);
+   float G = GeometrySmith(N, V, L, a);
+
+   float cosI = max(dot(N, L), 0.0);
+   float cosO = max(dot(N, V), 0.0);
+
+   // Important! Notice that Fresnel term (F) is not here because we apply it later when mixing with diffuse
+   float specular = (D * G) / (4.0f * cosO * cosI + 0.0001f);
+
+   return vec3(specular);
+}
+
+vec3 GetLambertianDiffuseLighting(vec3 albedo)
+{
+   // Diffuse scattered in all directions
+   return albedo / PI;
+}
+
+// light reflected towards V by a surface lit from L, with the metalness workflow
+vec3 GetPBRLighting(vec3 N, vec3 L, vec3 V, vec3 albedo, float roughness, float metalness, vec3 lightRadiance)
+{
+   // Get half vector
+   vec3 H = normalize(L + V);
+
+   // Compute diffuse lighting
+   vec3 diffuse = GetLambertianDiffuseLighting(albedo);
+   diffuse = mix(diffuse, vec3(0), metalness);
+
+   // Compute specular lighting
+   vec3 specular = GetCookTorranceSpecularLighting(N, L, V, roughness);
+
+   // Compute Fresnel
+   vec3 F0 = vec3(0.04f);
+   F0 = mix(F0, albedo, metalness);
+   vec3 F = FresnelSchlick(F0, max(dot(H, V), 0.0));
+
+   // Divide the incoming light between diffuse and specular, depending on Fresnel
+   vec3 lighting = mix(diffuse, specular, F);
+
+   // Apply the light
+   lighting *= lightRadiance * max(dot(N, L), 0.0);
+
+   return lighting;
+}
@@ -4,7 +4,12 @@ layout (location = 0) in vec3 vertex;
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
+// quantized positions are relative to the mesh bounds
+uniform vec3 positionOffset = vec3(0.0f);
+uniform vec3 positionScale = vec3(1.0f);
+
 void main()
 {
-   gl_Position = lightSpaceMatrix * model * vec4(vertex, 1.0);
+   vec3 position = positionOffset + vertex * positionScale;
+   gl_Position = lightSpaceMatrix * model * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,320 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "render_state.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// the shadows of the point lights, every one in a region of one large depth texture. a region is the six faces of
+// the cube around the light, each a square tile whose size the application picks from how large the light is on
+// screen. the tiles come from a quadtree: a tile is split in four to make smaller ones, and four free siblings are
+// merged back. a light is only drawn again when it moved, its tile size changed, or its version did, which the
+// application increments when the objects in its reach change, and at most a few lights are drawn per frame, the
+// others keep their last shadow until their turn
+class ShadowAtlas
+{
+public:
+    // size is the width and height of the atlas, the tiles are powers of two from minTileSize to maxTileSize
+    ShadowAtlas(GLsizei size, GLsizei minTileSize, GLsizei maxTileSize)
+        : size(size), minTileSize(minTileSize), maxTileSize(maxTileSize), texture(0), framebuffer(0),
+          maxUpdates(0), updatedLights(0), drawnFaces(0)
+    {
+        // the texture binding is put back, it may be cached by the caller
+        GLint boundTexture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, (GLuint)boundTexture);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // the whole atlas is the only free tile at first
+        freeTiles.resize(levelOf(minTileSize) + 1);
+        freeTiles[0].push_back(glm::ivec2(0));
+    }
+
+    ~ShadowAtlas()
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &texture);
+    }
+
+    // the atlas owns GL objects, so it can't be copied
+    ShadowAtlas(const ShadowAtlas&) = delete;
+    ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+    // starts a frame, in which at most maxUpdates lights are drawn
+    void BeginFrame(unsigned int maxUpdates)
+    {
+        this->maxUpdates = maxUpdates;
+        updatedLights = drawnFaces = 0;
+        for (std::map<unsigned int, Region>::iterator it = regions.begin(); it != regions.end(); ++it)
+            it->second.used = false;
+    }
+
+    // keeps a region for the light, with faces of about tileSize, and draws it if it changed. draw is called for every
+    // face with the matrix from world space to the face, with the face's framebuffer and viewport set. the lights that
+    // matter the most should come first, they get the updates of the frame. returns whether the light has a shadow
+    bool Update(unsigned int light, const glm::vec3 &position, float radius, GLsizei tileSize, unsigned int version,
+                const std::function<void(const glm::mat4&)> &draw)
+    {
+        tileSize = std::max(minTileSize, std::min(tileSize, maxTileSize));
+        std::map<unsigned int, Region>::iterator it = regions.find(light);
+        if (it != regions.end() && it->second.requestedTileSize != tileSize)
+        {
+            freeRegion(it->second);
+            regions.erase(it);
+            it = regions.end();
+        }
+
+        // a new region, or one of another size, with smaller tiles if the atlas is too full for these
+        if (it == regions.end())
+        {
+            Region region;
+            region.drawn = false;
+            region.requestedTileSize = tileSize;
+            while (!allocateRegion(region, tileSize))
+            {
+                if (tileSize <= minTileSize)
+                    return false;
+                tileSize /= 2;
+            }
+            it = regions.insert(std::make_pair(light, region)).first;
+        }
+
+        Region &region = it->second;
+        region.used = true;
+        bool changed = !region.drawn || region.position != position || region.radius != radius || region.version != version;
+        if (!changed)
+            return true;
+        // out of updates, the light keeps the shadow it had, if it had one
+        if (updatedLights >= maxUpdates)
+            return region.drawn;
+
+        region.position = position;
+        region.radius = radius;
+        region.version = version;
+        region.drawn = true;
+        drawRegion(region, draw);
+        updatedLights++;
+        return true;
+    }
+
+    // frees the regions of the lights that weren't updated this frame
+    void EndFrame()
+    {
+        for (std::map<unsigned int, Region>::iterator it = regions.begin(); it != regions.end();)
+        {
+            if (it->second.used)
+                ++it;
+            else
+            {
+                freeRegion(it->second);
+                it = regions.erase(it);
+            }
+        }
+    }
+
+    // whether the light got a shadow this frame
+    bool Contains(unsigned int light) const
+    {
+        std::map<unsigned int, Region>::const_iterator it = regions.find(light);
+        return it != regions.end() && it->second.used && it->second.drawn;
+    }
+
+    // the point light shadow uniforms of shaders/lighting.frag, the atlas texture is bound by the caller.
+    // inverseView transforms from the view space of the lighting pass to world space
+    void SetUniforms(Shader &shader, unsigned int light, const glm::mat4 &inverseView) const
+    {
+        static std::string matrixNames[6], rectNames[6];
+        if (matrixNames[0].empty())
+        {
+            for (int face = 0; face < 6; face++)
+            {
+                matrixNames[face] = "shadowFaceMatrices[" + std::to_string(face) + "]";
+                rectNames[face] = "shadowFaceRects[" + std::to_string(face) + "]";
+            }
+        }
+
+        const Region &region = regions.find(light)->second;
+        float tileScale = (float)region.tileSize / size;
+        for (int face = 0; face < 6; face++)
+        {
+            shader.setMat4(matrixNames[face], region.faceMatrices[face] * inverseView);
+            shader.setVec4(rectNames[face], glm::vec4(glm::vec2(region.tiles[face]) / (float)size, tileScale, tileScale));
+        }
+        shader.setMat3("shadowViewToWorld", glm::mat3(inverseView));
+        shader.setVec2("shadowNearFar", NEAR_PLANE, region.radius);
+        shader.setFloat("shadowAtlasTexelSize", 1.0f / size);
+    }
+
+    GLuint Texture() const { return texture; }
+
+    // lights with a region, and lights and faces drawn this frame
+    unsigned int LightCount() const { return (unsigned int)regions.size(); }
+    unsigned int UpdatedLights() const { return updatedLights; }
+    unsigned int DrawnFaces() const { return drawnFaces; }
+
+    // fraction of the atlas that is in use
+    float Usage() const
+    {
+        float used = 0.0f;
+        for (std::map<unsigned int, Region>::const_iterator it = regions.begin(); it != regions.end(); ++it)
+            used += 6.0f * it->second.tileSize * it->second.tileSize;
+        return used / ((float)size * size);
+    }
+
+private:
+    static constexpr float NEAR_PLANE = 0.05f;
+
+    struct Region
+    {
+        glm::vec3 position;
+        float radius;
+        unsigned int version;
+        GLsizei tileSize, requestedTileSize; // smaller than requested when the atlas was full
+        glm::ivec2 tiles[6]; // corner of every face in the atlas, in texels
+        glm::mat4 faceMatrices[6]; // from world space to every face, as it was drawn
+        bool drawn, used;
+    };
+
+    GLsizei size, minTileSize, maxTileSize;
+    GLuint texture, framebuffer;
+
+    std::map<unsigned int, Region> regions; // by light
+    std::vector<std::vector<glm::ivec2> > freeTiles; // corners of the free tiles of every level, level 0 is the whole atlas
+
+    unsigned int maxUpdates, updatedLights, drawnFaces;
+
+    int levelOf(GLsizei tileSize) const
+    {
+        int level = 0;
+        while ((size >> level) > tileSize)
+            level++;
+        return level;
+    }
+
+    // a free tile of the level, splitting a larger one if there is none
+    bool allocateTile(int level, glm::ivec2 &tile)
+    {
+        if (level < 0)
+            return false;
+        if (!freeTiles[level].empty())
+        {
+            tile = freeTiles[level].back();
+            freeTiles[level].pop_back();
+            return true;
+        }
+        if (!allocateTile(level - 1, tile))
+            return false;
+        GLsizei half = size >> level;
+        freeTiles[level].push_back(tile + glm::ivec2(half, 0));
+        freeTiles[level].push_back(tile + glm::ivec2(0, half));
+        freeTiles[level].push_back(tile + glm::ivec2(half, half));
+        return true;
+    }
+
+    // gives the tile back, merged with its siblings if they are all free
+    void freeTile(int level, const glm::ivec2 &tile)
+    {
+        GLsizei tileSize = size >> level;
+        std::vector<glm::ivec2> &tiles = freeTiles[level];
+        if (level > 0)
+        {
+            glm::ivec2 parent = tile / (2 * tileSize) * (2 * tileSize);
+            std::vector<size_t> siblings;
+            for (size_t i = 0; i < tiles.size(); i++)
+                if (tiles[i] / (2 * tileSize) * (2 * tileSize) == parent)
+                    siblings.push_back(i);
+            if (siblings.size() == 3)
+            {
+                for (int i = 2; i >= 0; i--)
+                {
+                    tiles[siblings[i]] = tiles.back();
+                    tiles.pop_back();
+                }
+                freeTile(level - 1, parent);
+                return;
+            }
+        }
+        tiles.push_back(tile);
+    }
+
+    bool allocateRegion(Region &region, GLsizei tileSize)
+    {
+        int level = levelOf(tileSize);
+        for (int face = 0; face < 6; face++)
+        {
+            if (!allocateTile(level, region.tiles[face]))
+            {
+                for (int allocated = face - 1; allocated >= 0; allocated--)
+                    freeTile(level, region.tiles[allocated]);
+                return false;
+            }
+        }
+        region.tileSize = tileSize;
+        return true;
+    }
+
+    void freeRegion(const Region &region)
+    {
+        int level = levelOf(region.tileSize);
+        for (int face = 0; face < 6; face++)
+            freeTile(level, region.tiles[face]);
+    }
+
+    // the six faces of the cube around the light, in the order +x, -x, +y, -y, +z, -z that lighting.frag picks them
+    void drawRegion(Region &region, const std::function<void(const glm::mat4&)> &draw)
+    {
+        static const glm::vec3 directions[6] = {
+            glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)
+        };
+        static const glm::vec3 ups[6] = {
+            glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0)
+        };
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        // the clear only touches the face's tile
+        RenderState::instance().enable(GL_SCISSOR_TEST);
+
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, region.radius);
+        for (int face = 0; face < 6; face++)
+        {
+            region.faceMatrices[face] = projection * glm::lookAt(region.position, region.position + directions[face], ups[face]);
+
+            glViewport(region.tiles[face].x, region.tiles[face].y, region.tileSize, region.tileSize);
+            glScissor(region.tiles[face].x, region.tiles[face].y, region.tileSize, region.tileSize);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            draw(region.faceMatrices[face]);
+            drawnFaces++;
+        }
+
+        RenderState::instance().disable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+};
+#endif
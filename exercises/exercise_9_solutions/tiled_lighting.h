@@ -0,0 +1,169 @@
+#ifndef TILED_LIGHTING_H
+#define TILED_LIGHTING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <render_state.h>
+#include <shader.h>
+
+#include <string>
+#include <vector>
+
+// shades the point lights of the deferred renderer in one compute pass instead of a light volume per light.
+// the screen is split in tiles, and each tile is shaded with the lights whose sphere touches the depth range of its
+// pixels, see shaders/tiled_lighting.comp. the g-buffers are read once per pixel, not once per light and pixel, so the
+// cost of a light is only its culling and its lighting where it is visible.
+// a tile keeps at most MAX_TILE_LIGHTS lights and drops the others, the tiles where that happened are counted
+class TiledLighting
+{
+public:
+    // has to match the compute shader
+    static const int MAX_TILE_LIGHTS = 256;
+
+    // defines select the g-buffer layout, like the other shaders that read the g-buffers
+    TiledLighting(const std::vector<std::string> &defines = std::vector<std::string>()) : lightBuffer(0), lightBufferCapacity(0), program(0),
+                                                                                            overflowFrame(0), overflowTiles(0)
+    {
+        glGenBuffers(1, &lightBuffer);
+
+        // one counter per frame in flight, so reading one back doesn't wait for the GPU
+        glGenBuffers(OVERFLOW_FRAMES, overflowBuffers);
+        GLuint zero = 0;
+        for (int i = 0; i < OVERFLOW_FRAMES; i++)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBuffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        program = Shader::createComputeProgram("shaders/tiled_lighting.comp", defines);
+
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "AlbedoGBuffer"), 0);
+        glUniform1i(glGetUniformLocation(program, "NormalGBuffer"), 1);
+        glUniform1i(glGetUniformLocation(program, "OthersGBuffer"), 2);
+        glUniform1i(glGetUniformLocation(program, "DepthBuffer"), 3);
+        glUseProgram(0);
+        lightCountLocation = glGetUniformLocation(program, "lightCount");
+        invProjectionLocation = glGetUniformLocation(program, "invProjection");
+    }
+
+    ~TiledLighting()
+    {
+        glDeleteBuffers(1, &lightBuffer);
+        glDeleteBuffers(OVERFLOW_FRAMES, overflowBuffers);
+        glDeleteProgram(program);
+    }
+
+    // the pass owns GL objects, so it can't be copied
+    TiledLighting(const TiledLighting&) = delete;
+    TiledLighting& operator=(const TiledLighting&) = delete;
+
+    // compute shaders and shader storage buffers are core in GL 4.3, the exercises might run on a lower version
+    static bool supportsComputeShaders()
+    {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+    // the lights are gathered again every frame, they move with the camera
+    void ClearLights()
+    {
+        lights.clear();
+    }
+
+    // position in view space, and radiance as the light color times its intensity
+    void AddLight(const glm::vec3 &viewPosition, float radius, const glm::vec3 &radiance)
+    {
+        GpuLight light;
+        light.positionRadius = glm::vec4(viewPosition, radius);
+        light.radiance = glm::vec4(radiance, 0.0f);
+        lights.push_back(light);
+    }
+
+    // adds the lighting of the lights to the accumulation texture, a GL_RGBA16F texture as big as the g-buffers
+    void Shade(GLuint albedo, GLuint normal, GLuint others, GLuint depth, GLuint accumulation, int width, int height, const glm::mat4 &projection)
+    {
+        if (lights.empty())
+            return;
+
+        // the buffer only grows, and is orphaned when it is written again
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+        if (lights.size() > lightBufferCapacity)
+            lightBufferCapacity = lights.size();
+        glBufferData(GL_SHADER_STORAGE_BUFFER, lightBufferCapacity * sizeof(GpuLight), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lights.size() * sizeof(GpuLight), &lights[0]);
+
+        // the oldest counter holds the overflowing tiles of OVERFLOW_FRAMES frames ago, it is read and counts this frame
+        GLuint overflowBuffer = overflowBuffers[overflowFrame];
+        overflowFrame = (overflowFrame + 1) % OVERFLOW_FRAMES;
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &overflowTiles);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glUseProgram(program);
+        glUniform1ui(lightCountLocation, (GLuint)lights.size());
+        glm::mat4 invProjection = glm::inverse(projection);
+        glUniformMatrix4fv(invProjectionLocation, 1, GL_FALSE, &invProjection[0][0]);
+
+        RenderState &renderState = RenderState::instance();
+        renderState.bindTexture(0, GL_TEXTURE_2D, albedo);
+        renderState.bindTexture(1, GL_TEXTURE_2D, normal);
+        renderState.bindTexture(2, GL_TEXTURE_2D, others);
+        renderState.bindTexture(3, GL_TEXTURE_2D, depth);
+        glBindImageTexture(0, accumulation, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, lightBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, overflowBuffer);
+
+        glDispatchCompute(TileCount(width), TileCount(height), 1);
+
+        // the accumulation texture is blended into and sampled by the passes after this one
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+    }
+
+    // lights of the last Shade
+    unsigned int LightCount() const
+    {
+        return (unsigned int)lights.size();
+    }
+
+    // tiles that had more than MAX_TILE_LIGHTS lights and lost some of their lighting, a few frames old
+    unsigned int OverflowTiles() const
+    {
+        return overflowTiles;
+    }
+
+    // tiles along a side of the screen, TILE_SIZE has to match the compute shader
+    static GLuint TileCount(int pixels)
+    {
+        return (GLuint)(pixels + TILE_SIZE - 1) / TILE_SIZE;
+    }
+
+private:
+    static const int TILE_SIZE = 16;
+    static const int OVERFLOW_FRAMES = 3;
+
+    // std430 layout of the lights in the compute shader
+    struct GpuLight
+    {
+        glm::vec4 positionRadius;
+        glm::vec4 radiance;
+    };
+
+    std::vector<GpuLight> lights;
+    GLuint lightBuffer;
+    size_t lightBufferCapacity;
+    GLuint program;
+    GLint lightCountLocation, invProjectionLocation;
+
+    GLuint overflowBuffers[OVERFLOW_FRAMES];
+    int overflowFrame;
+    GLuint overflowTiles;
+};
+#endif